@@ -0,0 +1,263 @@
+#ifndef ANALYSIS_CACHE_HPP
+#define ANALYSIS_CACHE_HPP
+
+#include <algorithm>
+#include <atomic>
+#include <cstdint>
+#include <cstdio>
+#include <cstring>
+#include <fstream>
+#include <string>
+#include <vector>
+#include "chess.hpp"
+
+// Search results kept on disk between runs, keyed by the full Zobrist hash
+//
+// The file is a header followed by buckets of four entries. An entry is two words, the key
+// xor the data and the data, so an entry torn by a crash or by two writers does not match its
+// key and reads as empty. Where mmap is available the file is mapped shared, so the results
+// a search writes are in the page cache at once and survive the process; elsewhere the table
+// is read into memory and written back through a temporary file that replaces the old one.
+class AnalysisCache
+{
+public:
+    static constexpr uint32_t version = 1;
+
+    // move 16 | score 16 | depth 8 | bound 8, the bound uses the values of the search's Bound
+    struct Entry
+    {
+        uint16_t move;
+        int16_t score;
+        uint8_t depth;
+        uint8_t bound;
+    };
+
+    AnalysisCache() = default;
+    ~AnalysisCache() { close(); }
+
+    AnalysisCache(const AnalysisCache&) = delete;
+    AnalysisCache& operator=(const AnalysisCache&) = delete;
+
+    // Opens the cache at path, a missing or damaged file is replaced by an empty one of mb MB
+    bool open(const std::string& path, const size_t mb)
+    {
+        close();
+
+        if (!valid(path) && !create(path, mb)) return false;
+
+        this->path = path;
+
+#ifdef CHESS_USE_MMAP
+        const int fd = ::open(path.c_str(), O_RDWR);
+        if (fd < 0) return false;
+
+        struct stat st;
+        if (::fstat(fd, &st) == 0)
+        {
+            void* map = ::mmap(nullptr, static_cast<size_t>(st.st_size), PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+
+            if (map != MAP_FAILED)
+            {
+                map_ = map;
+                map_size = static_cast<size_t>(st.st_size);
+                ::madvise(map, map_size, MADV_RANDOM);
+            }
+        }
+
+        ::close(fd);
+        if (!map_) return false;
+
+        words = reinterpret_cast<std::atomic<uint64_t>*>(static_cast<char*>(map_) + header_size);
+        count = (map_size - header_size) / bucket_bytes;
+#else
+        std::ifstream in(path, std::ios::binary);
+        in.seekg(0, std::ios::end);
+        const size_t size = static_cast<size_t>(in.tellg());
+        in.seekg(header_size);
+
+        count = (size - header_size) / bucket_bytes;
+        memory = std::vector<std::atomic<uint64_t>>(count * bucket_entries * 2);
+
+        std::vector<uint64_t> raw(memory.size());
+        in.read(reinterpret_cast<char*>(raw.data()), static_cast<std::streamsize>(raw.size() * sizeof(uint64_t)));
+        for (size_t i = 0; i < raw.size(); ++i) memory[i].store(raw[i], std::memory_order_relaxed);
+
+        words = memory.data();
+#endif
+
+        return true;
+    }
+
+    void close()
+    {
+        if (!isOpen()) return;
+
+        flush();
+
+#ifdef CHESS_USE_MMAP
+        ::munmap(map_, map_size);
+        map_ = nullptr;
+#else
+        memory.clear();
+#endif
+
+        words = nullptr;
+        count = 0;
+    }
+
+    bool isOpen() const { return words != nullptr; }
+
+    // Hands the written entries to the disk, called after every search
+    void flush()
+    {
+        if (!isOpen()) return;
+
+#ifdef CHESS_USE_MMAP
+        ::msync(map_, map_size, MS_ASYNC);
+#else
+        const std::string temporary = path + ".tmp";
+        std::ofstream out(temporary, std::ios::binary);
+        out.write(header().data(), header_size);
+
+        std::vector<uint64_t> raw(memory.size());
+        for (size_t i = 0; i < raw.size(); ++i) raw[i] = memory[i].load(std::memory_order_relaxed);
+        out.write(reinterpret_cast<const char*>(raw.data()), static_cast<std::streamsize>(raw.size() * sizeof(uint64_t)));
+        out.close();
+
+        if (out) std::rename(temporary.c_str(), path.c_str());
+#endif
+    }
+
+    bool probe(const uint64_t key, Entry& entry) const
+    {
+        if (!isOpen()) return false;
+
+        const std::atomic<uint64_t>* bucket = bucketOf(key);
+
+        for (size_t i = 0; i < bucket_entries; ++i)
+        {
+            const uint64_t data = bucket[2 * i + 1].load(std::memory_order_relaxed);
+            const uint64_t check = bucket[2 * i].load(std::memory_order_relaxed);
+
+            if (data != 0 && (check ^ data) == key)
+            {
+                entry = unpack(data);
+                return true;
+            }
+        }
+
+        return false;
+    }
+
+    // Replaces a shallower result for the same position, otherwise the shallowest entry of the bucket
+    void store(const uint64_t key, const Entry& entry)
+    {
+        if (!isOpen()) return;
+
+        std::atomic<uint64_t>* bucket = bucketOf(key);
+        size_t replace = 0;
+        int worst = INT32_MAX;
+
+        for (size_t i = 0; i < bucket_entries; ++i)
+        {
+            const uint64_t data = bucket[2 * i + 1].load(std::memory_order_relaxed);
+            const uint64_t check = bucket[2 * i].load(std::memory_order_relaxed);
+
+            if (data != 0 && (check ^ data) == key)
+            {
+                if (unpack(data).depth > entry.depth) return;
+                replace = i;
+                break;
+            }
+
+            const int depth = data == 0 ? -1 : unpack(data).depth;
+            if (depth < worst) worst = depth, replace = i;
+        }
+
+        const uint64_t data = pack(entry);
+        bucket[2 * replace].store(key ^ data, std::memory_order_relaxed);
+        bucket[2 * replace + 1].store(data, std::memory_order_relaxed);
+    }
+
+private:
+    static constexpr size_t bucket_entries = 4;
+    static constexpr size_t bucket_bytes = bucket_entries * 2 * sizeof(uint64_t);
+
+    // "BWAC" | version 32 | bucket count 64 | padding, so the buckets start on a cache line
+    static constexpr size_t header_size = 64;
+
+    static_assert(sizeof(std::atomic<uint64_t>) == sizeof(uint64_t) && std::atomic<uint64_t>::is_always_lock_free, "entries are atomics placed over the file");
+
+    static uint64_t pack(const Entry& e)
+    {
+        return uint64_t(e.move) | uint64_t(static_cast<uint16_t>(e.score)) << 16 | uint64_t(e.depth) << 32 | uint64_t(e.bound) << 40;
+    }
+
+    static Entry unpack(const uint64_t data)
+    {
+        return { static_cast<uint16_t>(data), static_cast<int16_t>(data >> 16), static_cast<uint8_t>(data >> 32), static_cast<uint8_t>(data >> 40) };
+    }
+
+    std::atomic<uint64_t>* bucketOf(const uint64_t key) const { return words + (key % count) * bucket_entries * 2; }
+
+    std::string header() const { return header(count); }
+
+    static std::string header(const uint64_t buckets)
+    {
+        std::string header(header_size, '\0');
+        std::memcpy(&header[0], "BWAC", 4);
+        std::memcpy(&header[4], &version, 4);
+        std::memcpy(&header[8], &buckets, 8);
+        return header;
+    }
+
+    // Header and size agree, so the file was completely created by this version
+    static bool valid(const std::string& path)
+    {
+        std::ifstream in(path, std::ios::binary);
+        std::string header(header_size, '\0');
+        if (!in.read(&header[0], header_size)) return false;
+
+        uint64_t buckets = 0;
+        std::memcpy(&buckets, &header[8], 8);
+
+        in.seekg(0, std::ios::end);
+        const uint64_t size = static_cast<uint64_t>(in.tellg());
+
+        return buckets > 0 && header == AnalysisCache::header(buckets) && size == header_size + buckets * bucket_bytes;
+    }
+
+    // Written to a temporary file first, so a crash never leaves a half created cache behind
+    static bool create(const std::string& path, const size_t mb)
+    {
+        const uint64_t buckets = std::max<uint64_t>(1, uint64_t(mb) * 1024 * 1024 / bucket_bytes);
+        const std::string temporary = path + ".tmp";
+        std::ofstream out(temporary, std::ios::binary);
+
+        out.write(header(buckets).data(), header_size);
+
+        const std::vector<char> zeros(1 << 20, 0);
+        for (uint64_t left = buckets * bucket_bytes; left > 0;)
+        {
+            const uint64_t n = std::min<uint64_t>(left, zeros.size());
+            out.write(zeros.data(), static_cast<std::streamsize>(n));
+            left -= n;
+        }
+
+        out.close();
+        return out && std::rename(temporary.c_str(), path.c_str()) == 0;
+    }
+
+    std::string path;
+    std::atomic<uint64_t>* words = nullptr;
+    size_t count = 0;
+
+#ifdef CHESS_USE_MMAP
+    void* map_ = nullptr;
+    size_t map_size = 0;
+#else
+    std::vector<std::atomic<uint64_t>> memory;
+#endif
+};
+
+#endif
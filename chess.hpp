@@ -33,14 +33,32 @@ VERSION: 0.8.20
 
 
 #include <functional>
+#include <type_traits>
 #include <utility>
 
 
 #include <cstdint>
-#ifdef CHESS_USE_PEXT
+#if defined(CHESS_USE_PEXT) || defined(__AVX2__)
 #    include <immintrin.h>
 #endif
 
+#if defined(CHESS_USE_PEXT) && defined(CHESS_COMPACT_ATTACKS)
+#    error "CHESS_USE_PEXT and CHESS_COMPACT_ATTACKS select different slider tables, define only one"
+#endif
+
+// Slider lookups can switch between magic multiplication and PEXT at runtime
+// on x86-64, so a single binary runs well on both old and new CPUs.
+#if !defined(CHESS_USE_PEXT) && !defined(CHESS_COMPACT_ATTACKS) && (defined(__x86_64__) || defined(_M_X64))
+#    define CHESS_PEXT_DISPATCH
+#    include <array>
+#    if defined(_MSC_VER)
+#        include <intrin.h>
+#        include <immintrin.h>
+#    else
+#        include <cpuid.h>
+#    endif
+#endif
+
 
 #if __cpp_lib_bitops >= 201907L
 #    include <bit>
@@ -948,10 +966,30 @@ namespace chess {
 }  // namespace chess
 
 namespace chess {
+    enum class SliderBackend : std::uint8_t { AUTO, MAGIC, PEXT, COMPACT };
+
     class attacks {
         using U64 = std::uint64_t;
 
-#ifdef CHESS_USE_PEXT
+#if defined(CHESS_COMPACT_ATTACKS)
+        // Kindergarten bitboards: the occupancy of a line is collapsed to a 6 bit index by a
+        // multiplication, and a handful of tables shared by all squares (about 9 KB in total,
+        // against roughly 840 KB for the magic tables) hold the attacks for every index.
+        static constexpr U64 FILE_B_BB = 0x0202020202020202ull;
+        static constexpr U64 DIAG_C7_H2 = 0x0004081020408000ull;
+
+        static inline Bitboard DiagMask[64] = {};
+        static inline Bitboard AntiDiagMask[64] = {};
+        // attacks along the first rank for [file][inner occupancy], repeated on every rank
+        static inline Bitboard FillUpAttacks[8][64] = {};
+        // attacks along the a-file for [rank][inner occupancy]
+        static inline Bitboard AFileAttacks[8][64] = {};
+
+        [[nodiscard]] static Bitboard lineAttacks(Bitboard mask, Square sq, Bitboard occupied) noexcept {
+            const auto index = ((occupied & mask).getBits() * FILE_B_BB) >> 58;
+            return mask & FillUpAttacks[static_cast<int>(sq.file())][index];
+        }
+#elif defined(CHESS_USE_PEXT)
         struct Magic {
             U64 mask;
             Bitboard* attacks;
@@ -963,17 +1001,74 @@ namespace chess {
             U64 magic;
             Bitboard* attacks;
             U64 shift;
-            U64 operator()(Bitboard b) const noexcept { return (((b & mask)).getBits() * magic) >> shift; }
+            U64 operator()(Bitboard b) const noexcept {
+#    ifdef CHESS_PEXT_DISPATCH
+                // the branch is perfectly predicted, and pext() is a single inlined instruction,
+                // so the search code calling into here is shared by both backends
+                if (use_pext_) return pext(b.getBits(), mask);
+#    endif
+                return (((b & mask)).getBits() * magic) >> shift;
+            }
         };
 #endif
 
+#ifdef CHESS_PEXT_DISPATCH
+        // Emits pext without requiring the whole translation unit to be compiled with -mbmi2.
+        [[nodiscard]] static U64 pext(U64 b, U64 mask) noexcept {
+#    if defined(_MSC_VER) && !defined(__clang__)
+            return _pext_u64(b, mask);
+#    else
+            U64 r;
+            __asm__("pextq %2, %1, %0" : "=r"(r) : "r"(b), "r"(mask));
+            return r;
+#    endif
+        }
+
+        [[nodiscard]] static std::array<unsigned, 4> cpuid(unsigned leaf) noexcept {
+            std::array<unsigned, 4> regs = {};
+#    if defined(_MSC_VER)
+            int r[4];
+            __cpuidex(r, static_cast<int>(leaf), 0);
+            for (int i = 0; i < 4; i++) regs[i] = static_cast<unsigned>(r[i]);
+#    else
+            if (__get_cpuid_max(0, nullptr) >= leaf) __cpuid_count(leaf, 0, regs[0], regs[1], regs[2], regs[3]);
+#    endif
+            return regs;
+        }
+
+        [[nodiscard]] static bool cpuHasBmi2() noexcept { return cpuid(0)[0] >= 7 && (cpuid(7)[1] & (1u << 8)); }
+
+        // Whether pext runs in hardware. AMD before Zen 3 (family 19h) implements it
+        // in microcode, which is much slower than a magic multiply.
+        [[nodiscard]] static bool cpuHasFastPext() noexcept {
+            if (!cpuHasBmi2()) return false;
+
+            const auto vendor = cpuid(0);
+            const bool amd    = (vendor[1] == 0x68747541 && vendor[3] == 0x69746e65)   // "AuthenticAMD"
+                             || (vendor[1] == 0x6f677948 && vendor[3] == 0x6e65476e);  // "HygonGenuine"
+            if (!amd) return true;
+
+            const auto eax = cpuid(1)[0];
+            return ((eax >> 8) & 0xF) + ((eax >> 20) & 0xFF) >= 0x19;
+        }
+
+        static inline SliderBackend backend_ = SliderBackend::AUTO;
+        static inline bool use_pext_         = false;
+#endif
+
         // Slow function to calculate bishop and rook attacks
         template <bool ISROOK>
         [[nodiscard]] static Bitboard sliderAttacks(Square sq, Bitboard occupied) noexcept;
 
+        // Kogge-Stone occluded fill of all generators in one direction, returns the attacked squares
+        template <Direction direction>
+        [[nodiscard]] static U64 koggeStone(U64 gen, U64 empty) noexcept;
+
+#ifndef CHESS_COMPACT_ATTACKS
         // Initializes the magic bitboard tables for sliding pieces
         static void initSliders(Square sq, Magic table[], U64 magic,
             const std::function<Bitboard(Square, Bitboard)>& attacks);
+#endif
 
         // clang-format off
         // pre-calculated lookup table for pawn attacks
@@ -1086,11 +1181,13 @@ namespace chess {
             0xa010109502200ULL,    0x4a02012000ULL,       0x500201010098b028ULL, 0x8040002811040900ULL,
             0x28000010020204ULL,   0x6000020202d0240ULL,  0x8918844842082200ULL, 0x4010011029020020ULL };
 
+#ifndef CHESS_COMPACT_ATTACKS
         static inline Bitboard RookAttacks[0x19000] = {};
         static inline Bitboard BishopAttacks[0x1480] = {};
 
         static inline Magic RookTable[64] = {};
         static inline Magic BishopTable[64] = {};
+#endif
 
     public:
         static constexpr Bitboard MASK_RANK[8] = { 0xff,         0xff00,         0xff0000,         0xff000000,
@@ -1193,6 +1290,41 @@ namespace chess {
         template <PieceType::underlying pt>
         [[nodiscard]] static Bitboard slider(Square sq, Bitboard occupied) noexcept;
 
+        /**
+         * @brief Returns the union of the attacks of all given sliders, computed set-wise with
+         * Kogge-Stone fills instead of table lookups, so it does not touch memory. Equal to OR-ing
+         * slider<pt>() over every square of sliders. The directions are filled in parallel with AVX2
+         * when the build enables it (e.g. -mavx2), otherwise one after another.
+         * @param sliders
+         * @param occupied
+         * @tparam pt
+         * @return
+         */
+        template <PieceType::underlying pt>
+        [[nodiscard]] static Bitboard setwise(Bitboard sliders, Bitboard occupied) noexcept;
+
+        /**
+         * @brief Selects how slider attack tables are indexed and rebuilds them. AUTO picks PEXT when
+         * the CPU implements it in hardware. Must not be called while other threads use the tables.
+         * @param backend
+         * @return false if the requested backend is not supported on this CPU/build, the tables are
+         * left untouched in that case
+         */
+        static bool setSliderBackend(SliderBackend backend);
+
+        /**
+         * @brief Returns the backend currently used for slider lookups, MAGIC or PEXT, or COMPACT
+         * when built with CHESS_COMPACT_ATTACKS.
+         * @return
+         */
+        [[nodiscard]] static SliderBackend sliderBackend() noexcept;
+
+        /**
+         * @brief Returns a short name for the active slider backend, e.g. for "info string" output.
+         * @return
+         */
+        [[nodiscard]] static std::string_view sliderBackendName() noexcept;
+
         /**
          * @brief [Internal Usage] Initializes the attacks for the bishop and rook. Called once at startup.
          */
@@ -1305,6 +1437,7 @@ namespace chess {
 
 #include <cstddef>
 #include <iterator>
+#include <limits>
 #include <stdexcept>
 
 
@@ -1405,6 +1538,49 @@ namespace chess {
 
         // Other
 
+        /**
+         * @brief Sorts the moves by Move::score(), highest first. Moves scoring below limit end up behind
+         * the sorted ones, in no particular order. This is a stable insertion sort, which is faster than
+         * std::sort for the short lists of a chess position and only reads the cached scores.
+         * @param limit
+         */
+        constexpr void sort(int limit = std::numeric_limits<std::int16_t>::min()) noexcept {
+            size_type sorted = 0;
+
+            for (size_type i = 0; i < size_; ++i) {
+                if (moves_[i].score() < limit) continue;
+
+                const auto move = moves_[i];
+                moves_[i] = moves_[sorted];
+
+                size_type j = sorted++;
+                for (; j > 0 && moves_[j - 1].score() < move.score(); --j) moves_[j] = moves_[j - 1];
+
+                moves_[j] = move;
+            }
+        }
+
+        /**
+         * @brief Moves the highest scoring move of [from, size()) to from and returns it. Ties go to the
+         * earlier move and the others keep their order, so picking every index in turn gives the order of
+         * sort(), while a node that cuts off after a few moves only pays for those.
+         * @param from
+         * @return
+         */
+        constexpr value_type pickBest(size_type from) noexcept {
+            size_type best = from;
+
+            for (size_type i = from + 1; i < size_; ++i) {
+                if (moves_[i].score() > moves_[best].score()) best = i;
+            }
+
+            const auto move = moves_[best];
+            for (size_type i = best; i > from; --i) moves_[i] = moves_[i - 1];
+            moves_[from] = move;
+
+            return move;
+        }
+
         /**
          * @brief Checks if a move is in the movelist, returns the index of the move if it is found, otherwise -1.
          * @param move
@@ -1454,14 +1630,55 @@ namespace chess {
             int pieces = PieceGenType::PAWN | PieceGenType::KNIGHT | PieceGenType::BISHOP |
             PieceGenType::ROOK | PieceGenType::QUEEN | PieceGenType::KING);
 
+        /**
+         * @brief Generates all pseudo legal moves for a position, i.e. moves which may leave the own
+         * king in check. Much cheaper than legalmoves() since no check, pin or attack masks are
+         * computed; filter the moves with Board::isLegal() before making them.
+         * @tparam mt
+         * @param movelist
+         * @param board
+         * @param pieces
+         */
+        template <MoveGenType mt = MoveGenType::ALL>
+        void static pseudolegalmoves(Movelist& movelist, const Board& board,
+            int pieces = PieceGenType::PAWN | PieceGenType::KNIGHT | PieceGenType::BISHOP |
+            PieceGenType::ROOK | PieceGenType::QUEEN | PieceGenType::KING);
+
+        /**
+         * @brief Generates all legal moves and stores scorer(move) in each move's score while the list is
+         * still hot in cache, e.g. for Movelist::sort(). The scorer is called exactly once per move.
+         * @tparam mt
+         * @tparam Scorer callable as int(const Move&), the result is truncated to 16 bits
+         * @param movelist
+         * @param board
+         * @param scorer
+         * @param pieces
+         */
+        template <MoveGenType mt = MoveGenType::ALL, typename Scorer,
+            typename = std::enable_if_t<std::is_invocable_r_v<int, Scorer&, const Move&>>>
+        void static legalmoves(Movelist& movelist, const Board& board, Scorer&& scorer,
+            int pieces = PieceGenType::PAWN | PieceGenType::KNIGHT | PieceGenType::BISHOP |
+            PieceGenType::ROOK | PieceGenType::QUEEN | PieceGenType::KING);
+
+        /**
+         * @brief Generates all pseudo legal moves and scores them, see legalmoves() with a scorer.
+         * @tparam mt
+         * @tparam Scorer callable as int(const Move&), the result is truncated to 16 bits
+         * @param movelist
+         * @param board
+         * @param scorer
+         * @param pieces
+         */
+        template <MoveGenType mt = MoveGenType::ALL, typename Scorer,
+            typename = std::enable_if_t<std::is_invocable_r_v<int, Scorer&, const Move&>>>
+        void static pseudolegalmoves(Movelist& movelist, const Board& board, Scorer&& scorer,
+            int pieces = PieceGenType::PAWN | PieceGenType::KNIGHT | PieceGenType::BISHOP |
+            PieceGenType::ROOK | PieceGenType::QUEEN | PieceGenType::KING);
+
     private:
         static auto init_squares_between();
         static const std::array<std::array<Bitboard, 64>, 64> SQUARES_BETWEEN_BB;
 
-        // Generate the checkmask. Returns a bitboard where the attacker path between the king and enemy piece is set.
-        template <Color::underlying c>
-        [[nodiscard]] static std::pair<Bitboard, int> checkMask(const Board& board, Square sq);
-
         // Generate the pin mask for horizontal and vertical pins -> PieceType::ROOK
         // Generate the pin mask for diagonal pins. -> PieceType::BISHOP
         // Returns a bitboard where the ray between the king and the pinner is set.
@@ -1496,8 +1713,11 @@ namespace chess {
         template <typename T>
         static void whileBitboardAdd(Movelist& movelist, Bitboard mask, T func);
 
-        template <Color::underlying c, MoveGenType mt>
-        static void legalmoves(Movelist& movelist, const Board& board, int pieces);
+        template <typename Scorer>
+        static void scoreMoves(Movelist& movelist, Scorer& scorer);
+
+        template <Color::underlying c, MoveGenType mt, bool legal>
+        static void generateMoves(Movelist& movelist, const Board& board, int pieces);
 
         template <Color::underlying c>
         static bool isEpSquareValid(const Board& board, Square ep);
@@ -1720,6 +1940,29 @@ namespace chess {
 
         [[nodiscard]] static U64 sideToMove() noexcept { return RANDOM_ARRAY[780]; }
 
+    public:
+        friend class Board;
+        friend class Cuckoo;
+    };
+
+    // Hash tables of all reversible piece moves, keyed by the zobrist difference they cause.
+    // Used by Board::hasUpcomingRepetition(), see Marcel van Kervinck's cuckoo cycle detection.
+    class Cuckoo {
+        using U64 = std::uint64_t;
+
+        static constexpr int SIZE = 8192;
+
+        [[nodiscard]] static int h1(U64 key) noexcept { return static_cast<int>(key & 0x1fff); }
+        [[nodiscard]] static int h2(U64 key) noexcept { return static_cast<int>((key >> 16) & 0x1fff); }
+
+        struct Table {
+            std::array<U64, SIZE> keys;
+            std::array<Move, SIZE> moves;
+        };
+
+        static Table init();
+        static const Table table;
+
     public:
         friend class Board;
     };
@@ -1782,6 +2025,15 @@ namespace chess {
     // does not include the half-move clock or full move number.
     using PackedBoard = std::array<std::uint8_t, 24>;
 
+    /**
+     * @brief A chess position with its move history.
+     *
+     * Checkers, pins and check squares are computed lazily, the first time inCheck(), checkers(),
+     * givesCheck(), isLegal() or movegen::legalmoves() need them, and cached until the position
+     * changes. These const methods therefore write to the board and are not thread-safe: two threads
+     * must not use the same Board, not even through a const reference, unless one of those methods
+     * (e.g. inCheck()) was called before the board was shared. After that they only read it.
+     */
     class Board {
         using U64 = std::uint64_t;
 
@@ -1830,20 +2082,37 @@ namespace chess {
         };
 
     private:
+        // Check and pin information for the side to move, computed on demand by checkInfo().
+        struct CheckInfo {
+            Bitboard checkers;
+            // squares a non-king move has to land on, all squares if not in check
+            Bitboard checkmask;
+            Bitboard pin_hv;
+            Bitboard pin_d;
+            // squares from which each piece type would attack the enemy king
+            std::array<Bitboard, 6> check_squares;
+            // own pieces standing between an own slider and the enemy king
+            Bitboard blockers;
+            bool valid = false;
+        };
+
         struct State {
             U64 hash;
             CastlingRights castling;
             Square enpassant;
             std::uint8_t half_moves;
             Piece captured_piece;
+            CheckInfo check_info;
+            bool null_move = false;
 
             State(const U64& hash, const CastlingRights& castling, const Square& enpassant, const std::uint8_t& half_moves,
-                const Piece& captured_piece)
+                const Piece& captured_piece, const CheckInfo& check_info)
                 : hash(hash),
                 castling(castling),
                 enpassant(enpassant),
                 half_moves(half_moves),
-                captured_piece(captured_piece) {
+                captured_piece(captured_piece),
+                check_info(check_info) {
             }
         };
 
@@ -2028,7 +2297,7 @@ namespace chess {
             // Validate side to move
             assert((at(move.from()) < Piece::BLACKPAWN) == (stm_ == Color::WHITE));
 
-            prev_states_.emplace_back(key_, cr_, ep_sq_, hfm_, captured);
+            prev_states_.emplace_back(key_, cr_, ep_sq_, hfm_, captured, check_info_);
 
             hfm_++;
             plies_++;
@@ -2249,6 +2518,7 @@ namespace chess {
             }
 
             key_ = prev.hash;
+            check_info_ = prev.check_info;
             prev_states_.pop_back();
         }
 
@@ -2256,7 +2526,10 @@ namespace chess {
          * @brief Make a null move. (Switches the side to move)
          */
         void makeNullMove() {
-            prev_states_.emplace_back(key_, cr_, ep_sq_, hfm_, Piece::NONE);
+            prev_states_.emplace_back(key_, cr_, ep_sq_, hfm_, Piece::NONE, check_info_);
+            prev_states_.back().null_move = true;
+
+            check_info_.valid = false;
 
             key_ ^= Zobrist::sideToMove();
             if (ep_sq_ != Square::NO_SQ) key_ ^= Zobrist::enpassant(ep_sq_.file());
@@ -2277,6 +2550,7 @@ namespace chess {
             cr_ = prev.castling;
             hfm_ = prev.half_moves;
             key_ = prev.hash;
+            check_info_ = prev.check_info;
 
             plies_--;
 
@@ -2376,6 +2650,82 @@ namespace chess {
          * @return
          */
         [[nodiscard]] U64 hash() const noexcept { return key_; }
+
+        /**
+         * @brief Computes the zobrist hash the board will have after makeMove<false>(move), without
+         * making the move. The move must be legal. Useful to prefetch hash table entries early.
+         * @param move
+         * @return
+         */
+        [[nodiscard]] U64 keyAfter(const Move move) const noexcept {
+            const auto from = move.from();
+            const auto to = move.to();
+            const auto piece = at(from);
+            const auto pt = piece.type();
+            const auto captured = at(to);
+
+            U64 key = key_ ^ Zobrist::sideToMove();
+            auto cr = cr_;
+
+            if (ep_sq_ != Square::NO_SQ) key ^= Zobrist::enpassant(ep_sq_.file());
+
+            if (move.typeOf() == Move::CASTLING) {
+                const bool king_side = to > from;
+                const auto rook_to = Square::castling_rook_square(king_side, stm_);
+                const auto king_to = Square::castling_king_square(king_side, stm_);
+
+                key ^= Zobrist::piece(piece, from) ^ Zobrist::piece(piece, king_to);
+                key ^= Zobrist::piece(captured, to) ^ Zobrist::piece(captured, rook_to);
+            }
+            else {
+                if (captured != Piece::NONE) {
+                    key ^= Zobrist::piece(captured, to);
+
+                    // capturing a rook removes its castling right
+                    if (captured.type() == PieceType::ROOK && Rank::back_rank(to.rank(), ~stm_)) {
+                        const auto side = CastlingRights::closestSide(to, kingSq(~stm_));
+                        if (cr.getRookFile(~stm_, side) == to.file()) cr.clear(~stm_, side);
+                    }
+                }
+
+                if (move.typeOf() == Move::PROMOTION) {
+                    key ^= Zobrist::piece(piece, from) ^ Zobrist::piece(Piece(move.promotionType(), stm_), to);
+                }
+                else {
+                    key ^= Zobrist::piece(piece, from) ^ Zobrist::piece(piece, to);
+                }
+
+                if (move.typeOf() == Move::ENPASSANT) {
+                    key ^= Zobrist::piece(Piece(PieceType::PAWN, ~stm_), to.ep_square());
+                }
+                else if (pt == PieceType::PAWN && Square::value_distance(to, from) == 16 &&
+                    (attacks::pawn(stm_, to.ep_square()) & pieces(PieceType::PAWN, ~stm_))) {
+                    key ^= Zobrist::enpassant(to.file());
+                }
+            }
+
+            if (pt == PieceType::KING) {
+                cr.clear(stm_);
+            }
+            else if (pt == PieceType::ROOK && Square::back_rank(from, stm_)) {
+                const auto side = CastlingRights::closestSide(from, kingSq(stm_));
+                if (cr.getRookFile(stm_, side) == from.file()) cr.clear(stm_, side);
+            }
+
+            return key ^ Zobrist::castling(cr_.hashIndex()) ^ Zobrist::castling(cr.hashIndex());
+        }
+
+        /**
+         * @brief Get the zobrist hash of the pawns only, e.g. to index a pawn structure cache
+         * @return
+         */
+        [[nodiscard]] U64 pawnKey() const noexcept { return pawn_key_; }
+
+        /**
+         * @brief Get the zobrist hash of the piece counts, independent of the squares
+         * @return
+         */
+        [[nodiscard]] U64 materialKey() const noexcept { return material_key_; }
         [[nodiscard]] Color sideToMove() const noexcept { return stm_; }
         [[nodiscard]] Square enpassantSq() const noexcept { return ep_sq_; }
         [[nodiscard]] CastlingRights castlingRights() const noexcept { return cr_; }
@@ -2445,6 +2795,66 @@ namespace chess {
             return false;
         }
 
+        /**
+         * @brief Checks if the side to move has a reversible move which reaches a position that occurred
+         * since the last irreversible move or null move, i.e. it can force a repetition. Cycles which lie
+         * within the search, with ply being the distance to the root, always count. Cycles reaching back
+         * into the game history only count if that position already occurred twice.
+         * @param ply
+         * @return
+         */
+        [[nodiscard]] bool hasUpcomingRepetition(int ply) const noexcept {
+            const auto size = static_cast<int>(prev_states_.size());
+            const int end = std::min<int>(hfm_, size);
+
+            if (end < 3) return false;
+
+            // zobrist key of the position k plies ago
+            const auto key = [&](int k) { return k == 0 ? key_ : prev_states_[size - k].hash; };
+            const auto null_move = [&](int k) { return prev_states_[size - k].null_move; };
+
+            if (null_move(1) || null_move(2)) return false;
+
+            U64 other = key_ ^ key(1) ^ Zobrist::sideToMove();
+
+            for (int i = 3; i <= end; i += 2) {
+                if (null_move(i - 1) || null_move(i)) return false;
+
+                other ^= key(i - 1) ^ key(i) ^ Zobrist::sideToMove();
+
+                // the side to move did not undo all of its own moves
+                if (other != 0) continue;
+
+                const U64 move_key = key_ ^ key(i);
+
+                int j = Cuckoo::h1(move_key);
+                if (Cuckoo::table.keys[j] != move_key) {
+                    j = Cuckoo::h2(move_key);
+                    if (Cuckoo::table.keys[j] != move_key) continue;
+                }
+
+                const auto move = Cuckoo::table.moves[j];
+                const auto s1 = move.from();
+                const auto s2 = move.to();
+
+                // the path of the move has to be free
+                if ((movegen::between(s1, s2) ^ Bitboard::fromSquare(s2)) & occ()) continue;
+
+                if (ply > i) return true;
+
+                // The table stores a move and its reverse in the same slot, so make sure it is ours to play.
+                const auto mover = at(s1) != Piece::NONE ? at(s1) : at(s2);
+                if (mover.color() != stm_) continue;
+
+                for (int k = i + 2; k <= end; k += 2) {
+                    if (null_move(k - 1) || null_move(k)) break;
+                    if (key(k) == key(i)) return true;
+                }
+            }
+
+            return false;
+        }
+
         /**
          * @brief Checks if the current position is a draw by 50 move rule.
          * Keep in mind that by the rules of chess, if the position has 50 half
@@ -2551,8 +2961,38 @@ namespace chess {
          * @brief Checks if the current side to move is in check
          * @return
          */
-        [[nodiscard]] bool inCheck() const noexcept { return isAttacked(kingSq(stm_), ~stm_); }
+        [[nodiscard]] bool inCheck() const noexcept { return bool(checkInfo().checkers); }
+
+        /**
+         * @brief Returns the pieces giving check to the side to move.
+         * Computed once per position and cached, like the pins used by isLegal().
+         * @return
+         */
+        [[nodiscard]] Bitboard checkers() const noexcept { return checkInfo().checkers; }
+
+        /**
+         * @brief Checks if a pseudo legal move leaves the own king safe, e.g. for moves from
+         * movegen::pseudolegalmoves(). Uses cached checkers and pins, so it is cheap to call on
+         * every move, see the class comment on sharing a board between threads.
+         * @param move
+         * @return
+         */
+        [[nodiscard]] bool isLegal(const Move& move) const noexcept;
 
+        /**
+         * @brief Checks if a move is pseudo legal in this position, i.e. legal except that it may leave
+         * the own king in check. Use it to validate a move from a transposition table before isLegal().
+         * @param move
+         * @return
+         */
+        [[nodiscard]] bool isPseudoLegal(const Move& move) const noexcept;
+
+        /**
+         * @brief Checks if a move gives check, without making it. Uses check squares and discovered
+         * check candidates which are cached per position, like the pins used by isLegal().
+         * @param m
+         * @return
+         */
         [[nodiscard]] CheckType givesCheck(const Move& m) const noexcept;
 
         /**
@@ -2595,6 +3035,7 @@ namespace chess {
         }
 
         friend std::ostream& operator<<(std::ostream& os, const Board& board);
+        friend class movegen;
 
         /**
          * @brief Compresses the board into a PackedBoard.
@@ -2781,6 +3222,8 @@ namespace chess {
                 board.occ_bb_.fill(0ULL);
                 board.pieces_bb_.fill(0ULL);
                 board.board_.fill(Piece::NONE);
+                board.pawn_key_ = 0ULL;
+                board.material_key_ = 0ULL;
 
                 // place pieces back on the board
                 while (occupied) {
@@ -2931,6 +3374,8 @@ namespace chess {
         std::array<Piece, 64> board_ = {};
 
         U64 key_ = 0ULL;
+        U64 pawn_key_ = 0ULL;
+        U64 material_key_ = 0ULL;
         CastlingRights cr_ = {};
         std::uint16_t plies_ = 0;
         Color stm_ = Color::WHITE;
@@ -2941,6 +3386,61 @@ namespace chess {
 
         std::array<std::array<Bitboard, 2>, 2> castling_path = {};
 
+        mutable CheckInfo check_info_ = {};
+
+        [[nodiscard]] const CheckInfo& checkInfo() const noexcept {
+            if (!check_info_.valid) {
+                const auto king_sq = kingSq(stm_);
+                const auto occ_us = us(stm_);
+                const auto occ_opp = us(~stm_);
+
+                check_info_.checkers = attacks::attackers(*this, ~stm_, king_sq);
+                check_info_.checkmask = check_info_.checkers ? Bitboard(0ull) : constants::DEFAULT_CHECKMASK;
+
+                for (auto checkers = check_info_.checkers; checkers;) {
+                    check_info_.checkmask |= movegen::between(king_sq, checkers.pop());
+                }
+
+                const auto opp_king_sq = kingSq(~stm_);
+                const auto bishop_checks = attacks::bishop(opp_king_sq, occ());
+                const auto rook_checks = attacks::rook(opp_king_sq, occ());
+
+                check_info_.check_squares = { attacks::pawn(~stm_, opp_king_sq), attacks::knight(opp_king_sq),
+                                              bishop_checks, rook_checks, bishop_checks | rook_checks, 0ull };
+
+                auto snipers = ((attacks::bishop(opp_king_sq, 0ull) & pieces(PieceType::BISHOP, PieceType::QUEEN)) |
+                    (attacks::rook(opp_king_sq, 0ull) & pieces(PieceType::ROOK, PieceType::QUEEN))) &
+                    occ_us;
+
+                check_info_.blockers = 0ull;
+
+                while (snipers) {
+                    const auto sniper = snipers.pop();
+                    const auto blockers = movegen::between(opp_king_sq, sniper) & occ() & ~Bitboard::fromSquare(sniper);
+
+                    if (blockers.count() == 1) check_info_.blockers |= blockers & occ_us;
+                }
+
+                if (stm_ == Color::WHITE) {
+                    check_info_.pin_hv = movegen::pinMask<Color::WHITE, PieceType::ROOK>(*this, king_sq, occ_opp, occ_us);
+                    check_info_.pin_d = movegen::pinMask<Color::WHITE, PieceType::BISHOP>(*this, king_sq, occ_opp, occ_us);
+                }
+                else {
+                    check_info_.pin_hv = movegen::pinMask<Color::BLACK, PieceType::ROOK>(*this, king_sq, occ_opp, occ_us);
+                    check_info_.pin_d = movegen::pinMask<Color::BLACK, PieceType::BISHOP>(*this, king_sq, occ_opp, occ_us);
+                }
+
+                check_info_.valid = true;
+            }
+
+            return check_info_;
+        }
+
+        // Checks if sq lies on the line through the king square and the other square
+        [[nodiscard]] static bool aligned(Square king_sq, Square other, Square sq) noexcept {
+            return movegen::between(king_sq, sq).check(other.index()) || movegen::between(king_sq, other).check(sq.index());
+        }
+
     private:
         void removePieceInternal(Piece piece, Square sq) {
             assert(board_[sq.index()] == piece && piece != Piece::NONE);
@@ -2956,6 +3456,12 @@ namespace chess {
             pieces_bb_[type].clear(index);
             occ_bb_[color].clear(index);
             board_[index] = Piece::NONE;
+
+            // the material key hashes the n-th piece of a kind as if it stood on square n
+            material_key_ ^= Zobrist::piece(piece, Square((pieces_bb_[type] & occ_bb_[color]).count()));
+            if (type == PieceType::PAWN) pawn_key_ ^= Zobrist::piece(piece, sq);
+
+            check_info_.valid = false;
         }
 
         void placePieceInternal(Piece piece, Square sq) {
@@ -2969,9 +3475,14 @@ namespace chess {
             assert(color != Color::NONE);
             assert(index >= 0 && index < 64);
 
+            material_key_ ^= Zobrist::piece(piece, Square((pieces_bb_[type] & occ_bb_[color]).count()));
+            if (type == PieceType::PAWN) pawn_key_ ^= Zobrist::piece(piece, sq);
+
             pieces_bb_[type].set(index);
             occ_bb_[color].set(index);
             board_[index] = piece;
+
+            check_info_.valid = false;
         }
 
         template <bool ctor = false>
@@ -3185,8 +3696,11 @@ namespace chess {
             hfm_ = 0;
             plies_ = 1;
             key_ = 0ULL;
+            pawn_key_ = 0ULL;
+            material_key_ = 0ULL;
             cr_.clear();
             prev_states_.clear();
+            check_info_ = {};
         }
 
         // store the original fen string
@@ -3217,58 +3731,46 @@ namespace chess {
     }
 
     inline CheckType Board::givesCheck(const Move& m) const noexcept {
-        const static auto getSniper = [](const Board* board, Square ksq, Bitboard oc) {
-            const auto us_occ = board->us(board->sideToMove());
-            const auto bishop = attacks::bishop(ksq, oc) & board->pieces(PieceType::BISHOP, PieceType::QUEEN) & us_occ;
-            const auto rook = attacks::rook(ksq, oc) & board->pieces(PieceType::ROOK, PieceType::QUEEN) & us_occ;
-            return (bishop | rook);
-            };
-
         assert(at(m.from()).color() == stm_);
 
+        const auto& info = checkInfo();
+
         const Square from = m.from();
         const Square to = m.to();
         const Square ksq = kingSq(~stm_);
+        const Bitboard fromBB = Bitboard::fromSquare(from);
         const Bitboard toBB = Bitboard::fromSquare(to);
-        const PieceType pt = at(from).type();
+        const Bitboard occ_us = us(stm_);
 
-        Bitboard fromKing = 0ull;
+        // own sliders which attack the king for a given occupancy
+        const auto sliderCheck = [&](Bitboard occupied, Bitboard sliders) {
+            return (attacks::bishop(ksq, occupied) & pieces(PieceType::BISHOP, PieceType::QUEEN) & sliders) ||
+                (attacks::rook(ksq, occupied) & pieces(PieceType::ROOK, PieceType::QUEEN) & sliders);
+            };
 
-        if (pt == PieceType::PAWN) {
-            fromKing = attacks::pawn(~stm_, ksq);
-        }
-        else if (pt == PieceType::KNIGHT) {
-            fromKing = attacks::knight(ksq);
-        }
-        else if (pt == PieceType::BISHOP) {
-            fromKing = attacks::bishop(ksq, occ());
-        }
-        else if (pt == PieceType::ROOK) {
-            fromKing = attacks::rook(ksq, occ());
-        }
-        else if (pt == PieceType::QUEEN) {
-            fromKing = attacks::queen(ksq, occ());
-        }
+        if (m.typeOf() == Move::CASTLING) {
+            const bool king_side = to > from;
+            const auto king_to = Square::castling_king_square(king_side, stm_);
+            const auto rook_to = Square::castling_rook_square(king_side, stm_);
+            const auto oc = (occ() ^ fromBB ^ toBB) | Bitboard::fromSquare(king_to) | Bitboard::fromSquare(rook_to);
 
-        if (fromKing & toBB) return CheckType::DIRECT_CHECK;
+            if (attacks::rook(rook_to, oc).check(ksq.index())) return CheckType::DIRECT_CHECK;
 
-        // Discovery check
-        const Bitboard fromBB = Bitboard::fromSquare(from);
-        const Bitboard oc = occ() ^ fromBB;
+            // the king and rook may both have been blocking another slider
+            return sliderCheck(oc, occ_us ^ toBB) ? CheckType::DISCOVERY_CHECK : CheckType::NO_CHECK;
+        }
 
-        Bitboard sniper = getSniper(this, ksq, oc);
+        if (info.check_squares[at(from).type()] & toBB) return CheckType::DIRECT_CHECK;
 
-        while (sniper) {
-            Square sq = sniper.pop();
-            return (!(movegen::between(ksq, sq) & toBB) || m.typeOf() == Move::CASTLING) ? CheckType::DISCOVERY_CHECK
-                : CheckType::NO_CHECK;
-        }
+        // the piece leaves the line between one of our sliders and the king
+        if ((info.blockers & fromBB) && !aligned(ksq, from, to)) return CheckType::DISCOVERY_CHECK;
 
         switch (m.typeOf()) {
         case Move::NORMAL:
             return CheckType::NO_CHECK;
 
         case Move::PROMOTION: {
+            const Bitboard oc = occ() ^ fromBB;
             Bitboard attacks = 0ull;
 
             switch (m.promotionType()) {
@@ -3285,19 +3787,14 @@ namespace chess {
                 attacks = attacks::queen(to, oc);
             }
 
-            return (attacks & pieces(PieceType::KING, ~stm_)) ? CheckType::DIRECT_CHECK : CheckType::NO_CHECK;
+            return attacks.check(ksq.index()) ? CheckType::DIRECT_CHECK : CheckType::NO_CHECK;
         }
 
         case Move::ENPASSANT: {
-            Square capSq(to.file(), from.rank());
-            return (getSniper(this, ksq, (oc ^ Bitboard::fromSquare(capSq)) | toBB)) ? CheckType::DISCOVERY_CHECK
-                : CheckType::NO_CHECK;
-        }
-
-        case Move::CASTLING: {
-            Square rookTo = Square::castling_rook_square(to > from, stm_);
-            return (attacks::rook(ksq, occ()) & Bitboard::fromSquare(rookTo)) ? CheckType::DISCOVERY_CHECK
-                : CheckType::NO_CHECK;
+            // removing the captured pawn may open a line as well
+            const Square capSq(to.file(), from.rank());
+            const Bitboard oc = (occ() ^ fromBB ^ Bitboard::fromSquare(capSq)) | toBB;
+            return sliderCheck(oc, occ_us) ? CheckType::DISCOVERY_CHECK : CheckType::NO_CHECK;
         }
         }
 
@@ -3305,27 +3802,310 @@ namespace chess {
         return CheckType::NO_CHECK;  // Prevent a compiler warning
     }
 
-}  // namespace  chess
+    inline bool Board::isLegal(const Move& move) const noexcept {
+        const auto& info = checkInfo();
+
+        const Square from = move.from();
+        const Square to = move.to();
+        const Square ksq = kingSq(stm_);
+        const Bitboard them = us(~stm_);
+
+        // attackers of the opponent on a square, for a hypothetical occupancy
+        const auto attacked = [&](Square sq, Bitboard occupied, Bitboard attackers) {
+            return (attacks::pawn(stm_, sq) & pieces(PieceType::PAWN) & attackers) ||
+                (attacks::knight(sq) & pieces(PieceType::KNIGHT) & attackers) ||
+                (attacks::king(sq) & pieces(PieceType::KING) & attackers) ||
+                (attacks::bishop(sq, occupied) & pieces(PieceType::BISHOP, PieceType::QUEEN) & attackers) ||
+                (attacks::rook(sq, occupied) & pieces(PieceType::ROOK, PieceType::QUEEN) & attackers);
+            };
 
-namespace chess {
+        if (move.typeOf() == Move::CASTLING) {
+            if (info.checkers) return false;
 
-    template <Direction direction>
-    [[nodiscard]] inline constexpr Bitboard attacks::shift(const Bitboard b) {
-        switch (direction) {
-        case Direction::NORTH:
-            return b << 8;
-        case Direction::SOUTH:
-            return b >> 8;
-        case Direction::NORTH_WEST:
-            return (b & ~MASK_FILE[0]) << 7;
-        case Direction::WEST:
-            return (b & ~MASK_FILE[0]) >> 1;
-        case Direction::SOUTH_WEST:
-            return (b & ~MASK_FILE[0]) >> 9;
-        case Direction::NORTH_EAST:
-            return (b & ~MASK_FILE[7]) << 9;
-        case Direction::EAST:
-            return (b & ~MASK_FILE[7]) << 1;
+            const auto king_to = Square::castling_king_square(to > from, stm_);
+
+            // every square the king passes, including its destination, must be safe
+            auto path = movegen::between(from, king_to);
+            while (path) {
+                if (isAttacked(path.pop(), ~stm_)) return false;
+            }
+
+            // Chess960: the castling rook may have been shielding the king's destination
+            return !chess960_ ||
+                !(attacks::rook(king_to, occ() ^ Bitboard::fromSquare(to)) & pieces(PieceType::ROOK, PieceType::QUEEN) & them);
+        }
+
+        if (move.typeOf() == Move::ENPASSANT) {
+            const Square cap_sq = to.ep_square();
+            const Bitboard occupied =
+                (occ() ^ Bitboard::fromSquare(from) ^ Bitboard::fromSquare(cap_sq)) | Bitboard::fromSquare(to);
+
+            return !attacked(ksq, occupied, them ^ Bitboard::fromSquare(cap_sq));
+        }
+
+        // the king may not step into an attack, also not along the line of a checking slider
+        if (from == ksq) return !attacked(to, occ() ^ Bitboard::fromSquare(from), them);
+
+        if (info.checkers) {
+            // only the king can evade a double check
+            if (info.checkers.count() > 1) return false;
+
+            // capture the checker or block the check
+            if (!(movegen::between(ksq, info.checkers.lsb()) & Bitboard::fromSquare(to))) return false;
+        }
+
+        // a pinned piece has to stay on the line through the king
+        if ((info.pin_hv | info.pin_d) & Bitboard::fromSquare(from)) return aligned(ksq, from, to);
+
+        return true;
+    }
+
+    inline bool Board::isPseudoLegal(const Move& move) const noexcept {
+        const Square from = move.from();
+        const Square to = move.to();
+        const Piece piece = at(from);
+
+        if (piece == Piece::NONE || piece.color() != stm_) return false;
+
+        // only promotions may carry a promotion piece
+        if (move.typeOf() != Move::PROMOTION && move.promotionType() != PieceType::KNIGHT) return false;
+
+        const PieceType pt = piece.type();
+
+        if (move.typeOf() == Move::CASTLING) {
+            const bool king_side = to > from;
+            const auto side = king_side ? CastlingRights::Side::KING_SIDE : CastlingRights::Side::QUEEN_SIDE;
+
+            if (pt != PieceType::KING || at(to) != Piece(PieceType::ROOK, stm_)) return false;
+            if (!Square::back_rank(from, stm_) || to.rank() != from.rank()) return false;
+            if (!cr_.has(stm_, side) || cr_.getRookFile(stm_, side) != to.file()) return false;
+
+            return !(occ() & getCastlingPath(stm_, king_side));
+        }
+
+        // also rejects Move::NO_MOVE and Move::NULL_MOVE, which have from == to
+        if (us(stm_).check(to.index())) return false;
+
+        if (move.typeOf() == Move::ENPASSANT) {
+            return pt == PieceType::PAWN && to == ep_sq_ && attacks::pawn(stm_, from).check(to.index());
+        }
+
+        if (pt == PieceType::PAWN) {
+            const bool promotion_rank = to.rank() == Rank::rank(Rank::RANK_8, stm_);
+            if ((move.typeOf() == Move::PROMOTION) != promotion_rank) return false;
+
+            if (attacks::pawn(stm_, from).check(to.index())) return us(~stm_).check(to.index());
+
+            const int up = stm_ == Color::WHITE ? 8 : -8;
+
+            if (to.index() == from.index() + up) return at(to) == Piece::NONE;
+
+            return to.index() == from.index() + 2 * up && from.rank() == Rank::rank(Rank::RANK_2, stm_) &&
+                at(to) == Piece::NONE && at(Square(from.index() + up)) == Piece::NONE;
+        }
+
+        if (move.typeOf() != Move::NORMAL) return false;
+
+        Bitboard targets = 0ull;
+
+        switch (pt.internal()) {
+        case PieceType::underlying::KNIGHT:
+            targets = attacks::knight(from);
+            break;
+        case PieceType::underlying::BISHOP:
+            targets = attacks::bishop(from, occ());
+            break;
+        case PieceType::underlying::ROOK:
+            targets = attacks::rook(from, occ());
+            break;
+        case PieceType::underlying::QUEEN:
+            targets = attacks::queen(from, occ());
+            break;
+        case PieceType::underlying::KING:
+            targets = attacks::king(from);
+            break;
+        default:
+            break;
+        }
+
+        return targets.check(to.index());
+    }
+
+    /**
+     * @brief Board which keeps per-color attack maps in sync with the position. Placing or removing
+     * a piece only updates that piece and the sliders whose rays run through the changed square,
+     * so makeMove()/unmakeMove() cost a few extra slider lookups instead of a full recomputation.
+     * Opt-in, the plain Board stays the faster choice when no attack information is needed.
+     */
+    class AttackBoard : public Board {
+    public:
+        explicit AttackBoard(std::string_view fen = constants::STARTPOS, bool chess960 = false)
+            : Board(fen, chess960) {
+            refresh();
+        }
+
+        bool setFen(std::string_view fen) override {
+            // setFen() places the pieces one by one through placePiece(), starting from an empty board
+            clearAttacks();
+            return Board::setFen(fen);
+        }
+
+        /**
+         * @brief Squares attacked by at least one piece of the given color.
+         * @param color
+         * @return
+         */
+        [[nodiscard]] Bitboard attacked(Color color) const noexcept {
+            const auto& d = counts_[color];
+            return d[0] | d[1] | d[2] | d[3] | d[4];
+        }
+
+        /**
+         * @brief Number of pieces of the given color attacking the square, x-rays are not counted.
+         * @param color
+         * @param sq
+         * @return
+         */
+        [[nodiscard]] int attackCount(Color color, Square sq) const noexcept {
+            int count = 0;
+            for (std::size_t i = 0; i < counts_[color].size(); i++) count |= counts_[color][i].check(sq.index()) << i;
+            return count;
+        }
+
+        /**
+         * @brief Squares attacked by the piece standing on sq, empty if the square is empty.
+         * @param sq
+         * @return
+         */
+        [[nodiscard]] Bitboard attacksFrom(Square sq) const noexcept { return attacks_from_[sq.index()]; }
+
+        /**
+         * @brief Recomputes all attack maps from scratch.
+         */
+        void refresh() {
+            clearAttacks();
+
+            for (auto occupied = occ(); occupied;) {
+                const auto sq = Square(occupied.pop());
+                const auto piece = at(sq);
+
+                attacks_from_[sq.index()] = pieceAttacks(piece, sq);
+                add(piece.color(), attacks_from_[sq.index()]);
+            }
+        }
+
+    protected:
+        void placePiece(Piece piece, Square sq) override {
+            Board::placePiece(piece, sq);
+
+            updateSliders(slidersThrough(sq));
+
+            attacks_from_[sq.index()] = pieceAttacks(piece, sq);
+            add(piece.color(), attacks_from_[sq.index()]);
+        }
+
+        void removePiece(Piece piece, Square sq) override {
+            remove(piece.color(), attacks_from_[sq.index()]);
+            attacks_from_[sq.index()] = 0ull;
+
+            Board::removePiece(piece, sq);
+
+            updateSliders(slidersThrough(sq));
+        }
+
+    private:
+        void clearAttacks() noexcept {
+            attacks_from_.fill(0ull);
+            counts_ = {};
+        }
+
+        [[nodiscard]] Bitboard pieceAttacks(Piece piece, Square sq) const noexcept {
+            switch (piece.type().internal()) {
+            case PieceType::underlying::PAWN:
+                return attacks::pawn(piece.color(), sq);
+            case PieceType::underlying::KNIGHT:
+                return attacks::knight(sq);
+            case PieceType::underlying::BISHOP:
+                return attacks::bishop(sq, occ());
+            case PieceType::underlying::ROOK:
+                return attacks::rook(sq, occ());
+            case PieceType::underlying::QUEEN:
+                return attacks::queen(sq, occ());
+            case PieceType::underlying::KING:
+                return attacks::king(sq);
+            default:
+                return 0ull;
+            }
+        }
+
+        // Sliders of both colors whose rays reach sq, the occupancy of sq itself does not matter
+        [[nodiscard]] Bitboard slidersThrough(Square sq) const noexcept {
+            return (attacks::bishop(sq, occ()) & pieces(PieceType::BISHOP, PieceType::QUEEN)) |
+                (attacks::rook(sq, occ()) & pieces(PieceType::ROOK, PieceType::QUEEN));
+        }
+
+        // Only the squares behind the changed square flip, so just those counters are touched
+        void updateSliders(Bitboard sliders) noexcept {
+            while (sliders) {
+                const auto sq = Square(sliders.pop());
+                const auto piece = at(sq);
+                const auto before = attacks_from_[sq.index()];
+                const auto after = pieceAttacks(piece, sq);
+
+                remove(piece.color(), before & ~after);
+                add(piece.color(), after & ~before);
+                attacks_from_[sq.index()] = after;
+            }
+        }
+
+        // Increments the counter of every target square at once, rippling the carry through the bit planes
+        void add(Color color, Bitboard targets) noexcept {
+            for (auto& plane : counts_[color]) {
+                const auto carry = plane & targets;
+                plane ^= targets;
+                targets = carry;
+            }
+
+            assert(!targets);
+        }
+
+        void remove(Color color, Bitboard targets) noexcept {
+            for (auto& plane : counts_[color]) {
+                const auto borrow = ~plane & targets;
+                plane ^= targets;
+                targets = borrow;
+            }
+
+            assert(!targets);
+        }
+
+        std::array<Bitboard, 64> attacks_from_ = {};
+        // per-square attacker counts stored bit-sliced, plane i holds bit i of every square's counter,
+        // five planes cover the at most 16 attackers one side can have
+        std::array<std::array<Bitboard, 5>, 2> counts_ = {};
+    };
+
+}  // namespace  chess
+
+namespace chess {
+
+    template <Direction direction>
+    [[nodiscard]] inline constexpr Bitboard attacks::shift(const Bitboard b) {
+        switch (direction) {
+        case Direction::NORTH:
+            return b << 8;
+        case Direction::SOUTH:
+            return b >> 8;
+        case Direction::NORTH_WEST:
+            return (b & ~MASK_FILE[0]) << 7;
+        case Direction::WEST:
+            return (b & ~MASK_FILE[0]) >> 1;
+        case Direction::SOUTH_WEST:
+            return (b & ~MASK_FILE[0]) >> 9;
+        case Direction::NORTH_EAST:
+            return (b & ~MASK_FILE[7]) << 9;
+        case Direction::EAST:
+            return (b & ~MASK_FILE[7]) << 1;
         case Direction::SOUTH_EAST:
             return (b & ~MASK_FILE[7]) >> 7;
         }
@@ -3351,6 +4131,22 @@ namespace chess {
 
     [[nodiscard]] inline Bitboard attacks::knight(Square sq) noexcept { return KnightAttacks[sq.index()]; }
 
+#ifdef CHESS_COMPACT_ATTACKS
+    [[nodiscard]] inline Bitboard attacks::bishop(Square sq, Bitboard occupied) noexcept {
+        return lineAttacks(DiagMask[sq.index()], sq, occupied) | lineAttacks(AntiDiagMask[sq.index()], sq, occupied);
+    }
+
+    [[nodiscard]] inline Bitboard attacks::rook(Square sq, Bitboard occupied) noexcept {
+        const int file = static_cast<int>(sq.file());
+        const int rank = static_cast<int>(sq.rank());
+
+        // the rank is already contiguous, the file is first shifted to the a-file and gathered
+        const auto rank_index = (occupied.getBits() >> (rank * 8 + 1)) & 63;
+        const auto file_index = (((occupied.getBits() >> file) & MASK_FILE[0].getBits()) * DIAG_C7_H2) >> 58;
+
+        return (FillUpAttacks[file][rank_index] & MASK_RANK[rank]) | (AFileAttacks[rank][file_index] << file);
+    }
+#else
     [[nodiscard]] inline Bitboard attacks::bishop(Square sq, Bitboard occupied) noexcept {
         return BishopTable[sq.index()].attacks[BishopTable[sq.index()](occupied)];
     }
@@ -3358,6 +4154,7 @@ namespace chess {
     [[nodiscard]] inline Bitboard attacks::rook(Square sq, Bitboard occupied) noexcept {
         return RookTable[sq.index()].attacks[RookTable[sq.index()](occupied)];
     }
+#endif
 
     [[nodiscard]] inline Bitboard attacks::queen(Square sq, Bitboard occupied) noexcept {
         return bishop(sq, occupied) | rook(sq, occupied);
@@ -3389,6 +4186,83 @@ namespace chess {
         if constexpr (pt == PieceType::QUEEN) return queen(sq, occupied);
     }
 
+    template <Direction direction>
+    [[nodiscard]] inline attacks::U64 attacks::koggeStone(U64 gen, U64 empty) noexcept {
+        constexpr int s = static_cast<int>(direction);
+        constexpr auto step = [](U64 b, int n) { return s > 0 ? b << (s * n) : b >> (-s * n); };
+
+        constexpr bool east = direction == Direction::EAST || direction == Direction::NORTH_EAST ||
+            direction == Direction::SOUTH_EAST;
+        constexpr bool west = direction == Direction::WEST || direction == Direction::NORTH_WEST ||
+            direction == Direction::SOUTH_WEST;
+
+        // squares that a step would reach by wrapping around the board edge
+        constexpr U64 mask = east ? ~MASK_FILE[0].getBits() : west ? ~MASK_FILE[7].getBits() : ~0ull;
+
+        U64 pro = empty & mask;
+        gen |= pro & step(gen, 1);
+        pro &= step(pro, 1);
+        gen |= pro & step(gen, 2);
+        pro &= step(pro, 2);
+        gen |= pro & step(gen, 4);
+
+        return step(gen, 1) & mask;
+    }
+
+    template <PieceType::underlying pt>
+    [[nodiscard]] inline Bitboard attacks::setwise(Bitboard sliders, Bitboard occupied) noexcept {
+        static_assert(pt == PieceType::BISHOP || pt == PieceType::ROOK || pt == PieceType::QUEEN,
+            "PieceType must be a slider!");
+
+        if constexpr (pt == PieceType::QUEEN) {
+            return setwise<PieceType::BISHOP>(sliders, occupied) | setwise<PieceType::ROOK>(sliders, occupied);
+        }
+        else {
+            const U64 gen = sliders.getBits();
+            const U64 empty = ~occupied.getBits();
+
+#ifdef __AVX2__
+            // One lane per direction. Lanes moving towards h8 shift left, the others right, a shift
+            // count of 64 or more yields zero, which disables the unused shift of each lane.
+            constexpr bool rook = pt == PieceType::ROOK;
+            constexpr auto not_a = static_cast<long long>(~MASK_FILE[0].getBits());
+            constexpr auto not_h = static_cast<long long>(~MASK_FILE[7].getBits());
+
+            const __m256i left = rook ? _mm256_setr_epi64x(8, 1, 64, 64) : _mm256_setr_epi64x(9, 7, 64, 64);
+            const __m256i right = rook ? _mm256_setr_epi64x(64, 64, 8, 1) : _mm256_setr_epi64x(64, 64, 7, 9);
+            const __m256i mask = rook ? _mm256_setr_epi64x(-1, not_a, -1, not_h) : _mm256_setr_epi64x(not_a, not_h, not_a, not_h);
+
+            const auto step = [&](__m256i b, int n) {
+                const __m128i log = _mm_cvtsi32_si128(n >> 1);
+                return _mm256_or_si256(_mm256_sllv_epi64(b, _mm256_sll_epi64(left, log)),
+                    _mm256_srlv_epi64(b, _mm256_sll_epi64(right, log)));
+            };
+
+            __m256i g = _mm256_set1_epi64x(static_cast<long long>(gen));
+            __m256i p = _mm256_and_si256(_mm256_set1_epi64x(static_cast<long long>(empty)), mask);
+
+            g = _mm256_or_si256(g, _mm256_and_si256(p, step(g, 1)));
+            p = _mm256_and_si256(p, step(p, 1));
+            g = _mm256_or_si256(g, _mm256_and_si256(p, step(g, 2)));
+            p = _mm256_and_si256(p, step(p, 2));
+            g = _mm256_or_si256(g, _mm256_and_si256(p, step(g, 4)));
+            g = _mm256_and_si256(step(g, 1), mask);
+
+            const __m128i half = _mm_or_si128(_mm256_castsi256_si128(g), _mm256_extracti128_si256(g, 1));
+            return static_cast<U64>(_mm_cvtsi128_si64(_mm_or_si128(half, _mm_unpackhi_epi64(half, half))));
+#else
+            if constexpr (pt == PieceType::ROOK) {
+                return koggeStone<Direction::NORTH>(gen, empty) | koggeStone<Direction::SOUTH>(gen, empty) |
+                    koggeStone<Direction::EAST>(gen, empty) | koggeStone<Direction::WEST>(gen, empty);
+            }
+            else {
+                return koggeStone<Direction::NORTH_EAST>(gen, empty) | koggeStone<Direction::NORTH_WEST>(gen, empty) |
+                    koggeStone<Direction::SOUTH_EAST>(gen, empty) | koggeStone<Direction::SOUTH_WEST>(gen, empty);
+            }
+#endif
+        }
+    }
+
     template <bool ISROOK>
     [[nodiscard]] inline Bitboard attacks::sliderAttacks(Square sq, Bitboard occupied) noexcept {
         static constexpr int dirs[2][4][2] = { {{1, 1}, {1, -1}, {-1, -1}, {-1, 1}}, {{1, 0}, {0, -1}, {-1, 0}, {0, 1}} };
@@ -3414,6 +4288,7 @@ namespace chess {
         return attacks;
     }
 
+#ifndef CHESS_COMPACT_ATTACKS
     inline void attacks::initSliders(Square sq, Magic table[], U64 magic,
         const std::function<Bitboard(Square, Bitboard)>& attacks) {
         // The edges of the board are not considered for the attacks
@@ -3442,8 +4317,88 @@ namespace chess {
             occ = (occ - table_sq.mask) & table_sq.mask;
         } while (occ);
     }
+#endif
+
+    inline bool attacks::setSliderBackend(SliderBackend backend) {
+#ifdef CHESS_PEXT_DISPATCH
+        // forcing pext on a CPU where it is slow is allowed, only a missing instruction is refused
+        if (backend == SliderBackend::PEXT && !cpuHasBmi2()) return false;
+        if (backend == SliderBackend::COMPACT) return false;
+
+        backend_ = backend;
+        initAttacks();
+        return true;
+#elif defined(CHESS_USE_PEXT)
+        return backend == SliderBackend::AUTO || backend == SliderBackend::PEXT;
+#elif defined(CHESS_COMPACT_ATTACKS)
+        return backend == SliderBackend::AUTO || backend == SliderBackend::COMPACT;
+#else
+        return backend == SliderBackend::AUTO || backend == SliderBackend::MAGIC;
+#endif
+    }
+
+    [[nodiscard]] inline SliderBackend attacks::sliderBackend() noexcept {
+#ifdef CHESS_PEXT_DISPATCH
+        return use_pext_ ? SliderBackend::PEXT : SliderBackend::MAGIC;
+#elif defined(CHESS_USE_PEXT)
+        return SliderBackend::PEXT;
+#elif defined(CHESS_COMPACT_ATTACKS)
+        return SliderBackend::COMPACT;
+#else
+        return SliderBackend::MAGIC;
+#endif
+    }
+
+    [[nodiscard]] inline std::string_view attacks::sliderBackendName() noexcept {
+        switch (sliderBackend()) {
+        case SliderBackend::PEXT:
+            return "pext";
+        case SliderBackend::COMPACT:
+            return "compact";
+        default:
+            return "magic";
+        }
+    }
 
     inline void attacks::initAttacks() {
+#ifdef CHESS_COMPACT_ATTACKS
+        for (int file = 0; file < 8; file++) {
+            for (U64 index = 0; index < 64; index++) {
+                const auto first_rank = sliderAttacks<true>(Square(File(file), Rank::RANK_1), Bitboard(index << 1)) & MASK_RANK[0];
+                FillUpAttacks[file][index] = first_rank.getBits() * MASK_FILE[0].getBits();
+            }
+        }
+
+        for (int rank = 0; rank < 8; rank++) {
+            for (U64 index = 0; index < 64; index++) {
+                Bitboard occ = 0ull;
+                for (int i = 0; i < 6; i++) {
+                    if (index & (1ull << i)) occ.set((i + 1) * 8);
+                }
+
+                AFileAttacks[rank][index] = sliderAttacks<true>(Square(File::FILE_A, Rank(rank)), occ) & MASK_FILE[0];
+            }
+        }
+
+        for (int sq = 0; sq < 64; sq++) {
+            const auto empty = sliderAttacks<false>(Square(sq), 0ull);
+            const int file = sq % 8, rank = sq / 8;
+
+            DiagMask[sq] = AntiDiagMask[sq] = 0ull;
+            for (auto bb = empty; bb;) {
+                const int to = bb.pop();
+                // on a diagonal file and rank differences have the same sign
+                if ((to % 8 - file) * (to / 8 - rank) > 0)
+                    DiagMask[sq].set(to);
+                else
+                    AntiDiagMask[sq].set(to);
+            }
+        }
+#else
+#    ifdef CHESS_PEXT_DISPATCH
+        use_pext_ = backend_ == SliderBackend::PEXT || (backend_ == SliderBackend::AUTO && cpuHasFastPext());
+#    endif
+
         BishopTable[0].attacks = BishopAttacks;
         RookTable[0].attacks = RookAttacks;
 
@@ -3451,6 +4406,7 @@ namespace chess {
             initSliders(static_cast<Square>(i), BishopTable, BishopMagics[i], sliderAttacks<false>);
             initSliders(static_cast<Square>(i), RookTable, RookMagics[i], sliderAttacks<true>);
         }
+#endif
     }
 }  // namespace chess
 
@@ -3480,55 +4436,6 @@ namespace chess {
         return squares_between_bb;
     }
 
-    template <Color::underlying c>
-    [[nodiscard]] inline std::pair<Bitboard, int> movegen::checkMask(const Board& board, Square sq) {
-        const auto opp_knight = board.pieces(PieceType::KNIGHT, ~c);
-        const auto opp_bishop = board.pieces(PieceType::BISHOP, ~c);
-        const auto opp_rook = board.pieces(PieceType::ROOK, ~c);
-        const auto opp_queen = board.pieces(PieceType::QUEEN, ~c);
-
-        const auto opp_pawns = board.pieces(PieceType::PAWN, ~c);
-
-        int checks = 0;
-
-        // check for knight checks
-        Bitboard knight_attacks = attacks::knight(sq) & opp_knight;
-        checks += bool(knight_attacks);
-
-        Bitboard mask = knight_attacks;
-
-        // check for pawn checks
-        Bitboard pawn_attacks = attacks::pawn(board.sideToMove(), sq) & opp_pawns;
-        mask |= pawn_attacks;
-        checks += bool(pawn_attacks);
-
-        // check for bishop checks
-        Bitboard bishop_attacks = attacks::bishop(sq, board.occ()) & (opp_bishop | opp_queen);
-
-        if (bishop_attacks) {
-            mask |= between(sq, bishop_attacks.lsb());
-            checks++;
-        }
-
-        Bitboard rook_attacks = attacks::rook(sq, board.occ()) & (opp_rook | opp_queen);
-
-        if (rook_attacks) {
-            if (rook_attacks.count() > 1) {
-                checks = 2;
-                return { mask, checks };
-            }
-
-            mask |= between(sq, rook_attacks.lsb());
-            checks++;
-        }
-
-        if (!mask) {
-            return { constants::DEFAULT_CHECKMASK, checks };
-        }
-
-        return { mask, checks };
-    }
-
     template <Color::underlying c, PieceType::underlying pt>
     [[nodiscard]] inline Bitboard movegen::pinMask(const Board& board, Square sq, Bitboard occ_opp,
         Bitboard occ_us) noexcept {
@@ -3833,8 +4740,8 @@ namespace chess {
         }
     }
 
-    template <Color::underlying c, movegen::MoveGenType mt>
-    inline void movegen::legalmoves(Movelist& movelist, const Board& board, int pieces) {
+    template <Color::underlying c, movegen::MoveGenType mt, bool legal>
+    inline void movegen::generateMoves(Movelist& movelist, const Board& board, int pieces) {
         /*
          The size of the movelist might not
          be 0! This is done on purpose since it enables
@@ -3848,9 +4755,20 @@ namespace chess {
 
         Bitboard opp_empty = ~occ_us;
 
-        const auto [checkmask, checks] = checkMask<c>(board, king_sq);
-        const auto pin_hv = pinMask<c, PieceType::ROOK>(board, king_sq, occ_opp, occ_us);
-        const auto pin_d = pinMask<c, PieceType::BISHOP>(board, king_sq, occ_opp, occ_us);
+        // Pseudo legal moves ignore checks and pins entirely
+        Bitboard checkmask = constants::DEFAULT_CHECKMASK;
+        Bitboard pin_hv = 0ull;
+        Bitboard pin_d = 0ull;
+        int checks = 0;
+
+        // Shared with Board::isLegal(), inCheck() and givesCheck(), computed once per position
+        if constexpr (legal) {
+            const auto& info = board.checkInfo();
+            checkmask = info.checkmask;
+            checks = std::min(info.checkers.count(), 2);
+            pin_hv = info.pin_hv;
+            pin_d = info.pin_d;
+        }
 
         assert(checks <= 2);
 
@@ -3865,7 +4783,7 @@ namespace chess {
             movable_square = ~occ_all;
 
         if (pieces & PieceGenType::KING) {
-            Bitboard seen = seenSquares<~c>(board, opp_empty);
+            Bitboard seen = legal ? seenSquares<~c>(board, opp_empty) : Bitboard(0ull);
 
             whileBitboardAdd(movelist, Bitboard::fromSquare(king_sq),
                 [&](Square sq) { return generateKingMoves(sq, seen, movable_square); });
@@ -3928,26 +4846,46 @@ namespace chess {
         movelist.clear();
 
         if (board.sideToMove() == Color::WHITE)
-            legalmoves<Color::WHITE, mt>(movelist, board, pieces);
+            generateMoves<Color::WHITE, mt, true>(movelist, board, pieces);
         else
-            legalmoves<Color::BLACK, mt>(movelist, board, pieces);
+            generateMoves<Color::BLACK, mt, true>(movelist, board, pieces);
+    }
+
+    template <movegen::MoveGenType mt>
+    inline void movegen::pseudolegalmoves(Movelist& movelist, const Board& board, int pieces) {
+        movelist.clear();
+
+        if (board.sideToMove() == Color::WHITE)
+            generateMoves<Color::WHITE, mt, false>(movelist, board, pieces);
+        else
+            generateMoves<Color::BLACK, mt, false>(movelist, board, pieces);
+    }
+
+    template <typename Scorer>
+    inline void movegen::scoreMoves(Movelist& movelist, Scorer& scorer) {
+        for (auto& move : movelist) move.setScore(static_cast<std::int16_t>(scorer(static_cast<const Move&>(move))));
+    }
+
+    template <movegen::MoveGenType mt, typename Scorer, typename>
+    inline void movegen::legalmoves(Movelist& movelist, const Board& board, Scorer&& scorer, int pieces) {
+        legalmoves<mt>(movelist, board, pieces);
+        scoreMoves(movelist, scorer);
+    }
+
+    template <movegen::MoveGenType mt, typename Scorer, typename>
+    inline void movegen::pseudolegalmoves(Movelist& movelist, const Board& board, Scorer&& scorer, int pieces) {
+        pseudolegalmoves<mt>(movelist, board, pieces);
+        scoreMoves(movelist, scorer);
     }
 
     template <Color::underlying c>
     inline bool movegen::isEpSquareValid(const Board& board, Square ep) {
         const auto stm = board.sideToMove();
-
-        Bitboard occ_us = board.us(stm);
-        Bitboard occ_opp = board.us(~stm);
-        auto king_sq = board.kingSq(stm);
-
-        const auto [checkmask, checks] = movegen::checkMask<c>(board, king_sq);
-        const auto pin_hv = movegen::pinMask<c, PieceType::ROOK>(board, king_sq, occ_opp, occ_us);
-        const auto pin_d = movegen::pinMask<c, PieceType::BISHOP>(board, king_sq, occ_opp, occ_us);
+        const auto& info = board.checkInfo();
 
         const auto pawns = board.pieces(PieceType::PAWN, stm);
-        const auto pawns_lr = pawns & ~pin_hv;
-        const auto m = movegen::generateEPMove(board, checkmask, pin_d, pawns_lr, ep, stm);
+        const auto pawns_lr = pawns & ~info.pin_hv;
+        const auto m = movegen::generateEPMove(board, info.checkmask, info.pin_d, pawns_lr, ep, stm);
         bool found = false;
 
         for (const auto& move : m) {
@@ -3969,9 +4907,136 @@ namespace chess {
         return movegen::init_squares_between();
         }();
 
+    inline Cuckoo::Table Cuckoo::init() {
+        Table table{};
+        [[maybe_unused]] int count = 0;
+
+        for (Piece piece : { Piece::WHITEKNIGHT, Piece::WHITEBISHOP, Piece::WHITEROOK, Piece::WHITEQUEEN, Piece::WHITEKING,
+                           Piece::BLACKKNIGHT, Piece::BLACKBISHOP, Piece::BLACKROOK, Piece::BLACKQUEEN, Piece::BLACKKING }) {
+            for (int sq1 = 0; sq1 < 64; ++sq1) {
+                Bitboard targets = 0ull;
+
+                switch (piece.type().internal()) {
+                case PieceType::underlying::KNIGHT:
+                    targets = attacks::knight(sq1);
+                    break;
+                case PieceType::underlying::BISHOP:
+                    targets = attacks::bishop(sq1, 0ull);
+                    break;
+                case PieceType::underlying::ROOK:
+                    targets = attacks::rook(sq1, 0ull);
+                    break;
+                case PieceType::underlying::QUEEN:
+                    targets = attacks::queen(sq1, 0ull);
+                    break;
+                default:
+                    targets = attacks::king(sq1);
+                    break;
+                }
+
+                for (int sq2 = sq1 + 1; sq2 < 64; ++sq2) {
+                    if (!targets.check(sq2)) continue;
+
+                    Move move = Move::make<Move::NORMAL>(Square(sq1), Square(sq2));
+                    U64 key = Zobrist::piece(piece, sq1) ^ Zobrist::piece(piece, sq2) ^ Zobrist::sideToMove();
+                    int i = h1(key);
+
+                    // insert, kicking out any entry already there into its other slot
+                    while (true) {
+                        std::swap(table.keys[i], key);
+                        std::swap(table.moves[i], move);
+
+                        if (move == Move::NO_MOVE) break;
+
+                        i = (i == h1(key)) ? h2(key) : h1(key);
+                    }
+
+                    count++;
+                }
+            }
+        }
+
+        assert(count == 3668);
+        return table;
+    }
+
+    // depends on the slider attacks, initialized together with SQUARES_BETWEEN_BB above
+    inline const Cuckoo::Table Cuckoo::table = Cuckoo::init();
+
 }  // namespace chess
 
+#include <atomic>
+#include <fstream>
 #include <istream>
+#include <iterator>
+#include <memory>
+#include <string>
+#include <thread>
+#include <vector>
+
+#if defined(__unix__) || defined(__unix) || defined(unix) || defined(__APPLE__)
+#    define CHESS_USE_MMAP
+#    include <fcntl.h>
+#    include <sys/mman.h>
+#    include <sys/stat.h>
+#    include <unistd.h>
+#endif
+
+namespace chess::detail {
+    /**
+     * @brief Private class, read-only view of a whole file. Memory mapped where mmap is
+     * available, so processes mapping the same file share it through the page cache,
+     * read into memory otherwise.
+     */
+    class MappedFile {
+    public:
+        explicit MappedFile(const std::string& path, bool sequential = false) {
+#ifdef CHESS_USE_MMAP
+            const int fd = ::open(path.c_str(), O_RDONLY);
+            if (fd < 0) return;
+
+            struct stat st;
+            if (::fstat(fd, &st) == 0 && st.st_size > 0) {
+                void* map = ::mmap(nullptr, static_cast<std::size_t>(st.st_size), PROT_READ, MAP_PRIVATE, fd, 0);
+
+                if (map != MAP_FAILED) {
+                    map_ = map;
+                    data_ = std::string_view(static_cast<const char*>(map), static_cast<std::size_t>(st.st_size));
+                    ::madvise(map, data_.size(), sequential ? MADV_SEQUENTIAL : MADV_RANDOM);
+                }
+            }
+
+            ::close(fd);
+#else
+            (void)sequential;
+
+            std::ifstream file(path, std::ios::binary);
+            contents_.assign(std::istreambuf_iterator<char>(file), std::istreambuf_iterator<char>());
+            data_ = contents_;
+#endif
+        }
+
+        ~MappedFile() {
+#ifdef CHESS_USE_MMAP
+            if (map_) ::munmap(map_, data_.size());
+#endif
+        }
+
+        MappedFile(const MappedFile&) = delete;
+        MappedFile& operator=(const MappedFile&) = delete;
+
+        std::string_view data() const noexcept { return data_; }
+
+    private:
+#ifdef CHESS_USE_MMAP
+        void* map_ = nullptr;
+#else
+        std::string contents_;
+#endif
+        std::string_view data_;
+    };
+
+}  // namespace chess::detail
 
 namespace chess::pgn {
 
@@ -4017,10 +5082,13 @@ namespace chess::pgn {
         class StreamBuffer {
         private:
             static constexpr std::size_t N = BUFFER_SIZE;
-            using BufferType = std::array<char, N* N>;
 
         public:
-            StreamBuffer(std::istream& stream) : stream_(stream) {}
+            StreamBuffer(std::istream& stream) : stream_(&stream), storage_(N * N), buffer_(storage_.data()) {}
+
+            // Reads straight from memory which has to outlive the buffer, nothing is copied
+            StreamBuffer(std::string_view data)
+                : buffer_(data.data()), unread_(static_cast<std::streamsize>(data.size())) {}
 
             // Get the current character, skip carriage returns
             std::optional<char> some() {
@@ -4079,8 +5147,14 @@ namespace chess::pgn {
             bool fill() {
                 buffer_index_ = 0;
 
-                stream_.read(buffer_.data(), N * N);
-                bytes_read_ = stream_.gcount();
+                // memory is handed out as a single buffer
+                if (!stream_) {
+                    bytes_read_ = std::exchange(unread_, 0);
+                    return bytes_read_ > 0;
+                }
+
+                stream_->read(storage_.data(), N * N);
+                bytes_read_ = stream_->gcount();
 
                 return bytes_read_ > 0;
             }
@@ -4095,7 +5169,7 @@ namespace chess::pgn {
 
             char peek() {
                 if (buffer_index_ + 1 >= bytes_read_) {
-                    return stream_.peek();
+                    return stream_ ? stream_->peek() : std::char_traits<char>::eof();
                 }
 
                 return buffer_[buffer_index_ + 1];
@@ -4110,8 +5184,10 @@ namespace chess::pgn {
             }
 
         private:
-            std::istream& stream_;
-            BufferType buffer_;
+            std::istream* stream_ = nullptr;
+            std::vector<char> storage_;
+            const char* buffer_;
+            std::streamsize unread_ = 0;
             std::streamsize bytes_read_ = 0;
             std::streamsize buffer_index_ = 0;
         };
@@ -4225,6 +5301,12 @@ namespace chess::pgn {
     public:
         StreamParser(std::istream& stream) : stream_buffer(stream) {}
 
+        /**
+         * @brief Parses PGN text held in memory without copying it, the memory has to outlive the parser.
+         * @param data
+         */
+        StreamParser(std::string_view data) : stream_buffer(data) {}
+
         StreamParserError readGames(Visitor& vis) {
             visitor = &vis;
 
@@ -4723,6 +5805,129 @@ namespace chess::pgn {
 
         bool dont_advance_after_body = false;
     };
+
+    /**
+     * @brief Reads a PGN file on several threads. The file is memory mapped and split at game
+     * boundaries (a tag at the start of a line following an empty line), then every chunk is parsed
+     * directly from the mapping by its own StreamParser and Visitor. Visitors are returned in file
+     * order, so merging their results in that order gives the same output as a serial run.
+     */
+    class ParallelStreamParser {
+    public:
+        /**
+         * @param path
+         * @param threads number of worker threads, 0 uses all hardware threads
+         */
+        explicit ParallelStreamParser(const std::string& path, unsigned threads = 0)
+            : file_(path, true), threads_(threads ? threads : std::max(1u, std::thread::hardware_concurrency())) {}
+
+        /**
+         * @brief Parses all games, creating one visitor per chunk from the given arguments.
+         * Visitors run concurrently, each only ever on one thread.
+         * @tparam V Visitor type
+         * @param visitors receives the visitors in file order
+         * @param args constructor arguments for every visitor
+         * @return the first error in file order
+         */
+        template <typename V, typename... Args>
+        StreamParserError readGames(std::vector<std::unique_ptr<V>>& visitors, const Args&... args) {
+            const auto data = file_.data();
+
+            // more chunks than threads, games differ in length and chunks finish unevenly
+            const auto bounds = split(data, threads_ * 8);
+            const auto chunks = bounds.size() - 1;
+
+            visitors.clear();
+            for (std::size_t i = 0; i < chunks; i++) visitors.push_back(std::make_unique<V>(args...));
+
+            if (chunks == 0) return StreamParserError::NotEnoughData;
+
+            std::vector<StreamParserError> errors(chunks, StreamParserError::None);
+            std::atomic<std::size_t> next = 0;
+
+            const auto work = [&]() {
+                for (std::size_t i; (i = next.fetch_add(1, std::memory_order_relaxed)) < chunks;) {
+                    StreamParser parser(data.substr(bounds[i], bounds[i + 1] - bounds[i]));
+                    errors[i] = parser.readGames(*visitors[i]);
+                }
+            };
+
+            std::vector<std::thread> workers;
+            for (std::size_t i = 1; i < std::min<std::size_t>(threads_, chunks); i++) workers.emplace_back(work);
+
+            work();
+
+            for (auto& worker : workers) worker.join();
+
+            for (const auto& error : errors) {
+                if (error != StreamParserError::None) return error;
+            }
+
+            return StreamParserError::None;
+        }
+
+    private:
+        // Returns chunk boundaries, each chunk but the first starts at a game
+        static std::vector<std::size_t> split(std::string_view data, std::size_t parts) {
+            std::vector<std::size_t> bounds = {0};
+
+            if (data.empty()) return bounds;
+
+            for (std::size_t i = 1; i < parts; i++) {
+                const auto start = nextGame(data, std::max(data.size() / parts * i, bounds.back()), bounds.back());
+
+                if (start >= data.size()) break;
+                if (start > bounds.back()) bounds.push_back(start);
+            }
+
+            bounds.push_back(data.size());
+
+            return bounds;
+        }
+
+        // First game start at or after pos: a tag pair line like [Event "..."] after an empty line,
+        // outside of a {...} comment. game_start is a known game start before pos, comments are
+        // looked for between the two.
+        static std::size_t nextGame(std::string_view data, std::size_t pos, std::size_t game_start) {
+            while ((pos = data.find("\n[", pos)) != std::string_view::npos) {
+                auto end = pos;
+
+                // the line before has to be empty, apart from a carriage return
+                if (end > 0 && data[end - 1] == '\r') --end;
+                if (end > 0 && data[end - 1] == '\n' && isTagPair(data, pos + 1) && !inComment(data, game_start, pos)) return pos + 1;
+
+                ++pos;
+            }
+
+            return data.size();
+        }
+
+        // [ followed by a tag name, spaces and a quote, so [%clk ...] and other comment text do not match
+        static bool isTagPair(std::string_view data, std::size_t pos) {
+            auto i = pos + 1;
+            const auto name = i;
+
+            while (i < data.size() && (std::isalnum(static_cast<unsigned char>(data[i])) || data[i] == '_')) ++i;
+            if (i == name || i >= data.size() || data[i] != ' ') return false;
+
+            while (i < data.size() && data[i] == ' ') ++i;
+            return i < data.size() && data[i] == '"';
+        }
+
+        // Comments do not nest, so the closest brace before pos tells whether pos is inside one
+        static bool inComment(std::string_view data, std::size_t game_start, std::size_t pos) {
+            while (pos > game_start) {
+                --pos;
+                if (data[pos] == '}') return false;
+                if (data[pos] == '{') return true;
+            }
+
+            return false;
+        }
+
+        chess::detail::MappedFile file_;
+        std::size_t threads_;
+    };
 }  // namespace chess::pgn
 
 
@@ -4881,7 +6086,7 @@ namespace chess {
          * This function will throw a SanParseError if the san string is invalid.
          * @param board
          * @param san
-         * @param moves
+         * @param moves scratch space, only filled when the move cannot be resolved directly
          * @return
          */
         [[nodiscard]] static Move parseSan(const Board& board, std::string_view san, Movelist& moves) noexcept(false) {
@@ -4892,6 +6097,10 @@ namespace chess {
             static constexpr auto pt_to_pgt = [](PieceType pt) { return 1 << (pt); };
             const SanMoveInformation info = parseSanInfo(san);
 
+            if (const auto move = resolveSan(board, info); move != Move::NO_MOVE) {
+                return move;
+            }
+
             if (info.capture) {
                 movegen::legalmoves<movegen::MoveGenType::CAPTURE>(moves, board, pt_to_pgt(info.piece));
             }
@@ -5019,6 +6228,88 @@ namespace chess {
             bool capture = false;
         };
 
+        // Resolves a san move without generating the legal move list: the pieces of the named type which
+        // reach the destination are found with reverse attack lookups and checked with Board::isLegal().
+        // Returns NO_MOVE unless exactly one move matches, parseSan() then falls back to the move list,
+        // which also takes care of castling, malformed input and the error messages.
+        [[nodiscard]] static Move resolveSan(const Board& board, const SanMoveInformation& info) noexcept {
+            if (info.castling_short || info.castling_long || info.to == Square::NO_SQ) return Move::NO_MOVE;
+
+            const auto stm = board.sideToMove();
+            const auto to = info.to;
+            const auto target = board.at(to);
+            const bool pawn = info.piece == PieceType::PAWN;
+            const bool enpassant = pawn && info.capture && to == board.enpassantSq();
+            const bool promotion = pawn && to.rank() == Rank::rank(Rank::RANK_8, stm);
+
+            // the capture sign has to agree with the destination, a pawn reaching the last rank must promote
+            if (info.capture ? !enpassant && (target == Piece::NONE || target.color() == stm) : target != Piece::NONE)
+                return Move::NO_MOVE;
+            if (promotion != (info.promotion != PieceType::NONE)) return Move::NO_MOVE;
+
+            Bitboard from = 0ull;
+
+            switch (info.piece.internal()) {
+            case PieceType::underlying::PAWN:
+                if (info.capture) {
+                    from = attacks::pawn(~stm, to);
+                }
+                else {
+                    const int back = stm == Color::WHITE ? -8 : 8;
+                    const int single = to.index() + back;
+
+                    if (single < 0 || single > 63) return Move::NO_MOVE;
+
+                    from = Bitboard::fromSquare(single);
+
+                    if (board.at(single) == Piece::NONE && to.rank() == Rank::rank(Rank::RANK_4, stm)) {
+                        from = Bitboard::fromSquare(single + back);
+                    }
+                }
+                break;
+            case PieceType::underlying::KNIGHT:
+                from = attacks::knight(to);
+                break;
+            case PieceType::underlying::BISHOP:
+                from = attacks::bishop(to, board.occ());
+                break;
+            case PieceType::underlying::ROOK:
+                from = attacks::rook(to, board.occ());
+                break;
+            case PieceType::underlying::QUEEN:
+                from = attacks::queen(to, board.occ());
+                break;
+            case PieceType::underlying::KING:
+                from = attacks::king(to);
+                break;
+            default:
+                return Move::NO_MOVE;
+            }
+
+            from &= board.pieces(info.piece, stm);
+
+            if (info.from_file != File::NO_FILE) from &= Bitboard(info.from_file);
+            if (info.from_rank != Rank::NO_RANK) from &= Bitboard(info.from_rank);
+
+            Move found = Move::NO_MOVE;
+
+            while (from) {
+                const Square sq = from.pop();
+                const Move move = promotion   ? Move::make<Move::PROMOTION>(sq, to, info.promotion)
+                                  : enpassant ? Move::make<Move::ENPASSANT>(sq, to)
+                                              : Move::make(sq, to);
+
+                if (!board.isLegal(move)) continue;
+
+                // ambiguous, let the move list report it
+                if (found != Move::NO_MOVE) return Move::NO_MOVE;
+
+                found = move;
+            }
+
+            return found;
+        }
+
         [[nodiscard]] static SanMoveInformation parseSanInfo(std::string_view san) noexcept(false) {
 #ifndef CHESS_NO_EXCEPTIONS
             if (san.length() < 2) {
@@ -5280,4 +6571,157 @@ namespace chess {
     };
 }  // namespace chess
 
+namespace chess::polyglot {
+    /**
+     * @brief Polyglot book entry, stored as 16 big-endian bytes. Books are sorted by key.
+     */
+    struct Entry {
+        std::uint64_t key = 0;
+        std::uint16_t move = 0;
+        std::uint16_t weight = 0;
+        std::uint32_t learn = 0;
+    };
+
+    /**
+     * @brief Returns the Polyglot key of the position. Board hashes with the Polyglot random
+     * numbers and only records en passant squares a pawn can capture on, so this is Board::hash().
+     * @param board
+     * @return
+     */
+    [[nodiscard]] inline std::uint64_t key(const Board& board) noexcept { return board.hash(); }
+
+    /**
+     * @brief Encodes a move in Polyglot format. Castling is king takes rook, as in Move.
+     * @param move
+     * @return
+     */
+    [[nodiscard]] inline std::uint16_t encode(const Move& move) noexcept {
+        // square indices are file + 8 * rank, the layout Polyglot uses for both squares
+        int m = move.to().index() | move.from().index() << 6;
+
+        if (move.typeOf() == Move::PROMOTION) m |= (move.promotionType() - PieceType(PieceType::KNIGHT) + 1) << 12;
+
+        return static_cast<std::uint16_t>(m);
+    }
+
+    /**
+     * @brief Finds the legal move a Polyglot move stands for.
+     * @param board
+     * @param move
+     * @return Move::NO_MOVE if the move is not legal in the position
+     */
+    [[nodiscard]] inline Move decode(const Board& board, std::uint16_t move) {
+        Movelist moves;
+        movegen::legalmoves(moves, board);
+
+        for (const auto& m : moves) {
+            if (encode(m) == move) return m;
+        }
+
+        return Move::NO_MOVE;
+    }
+
+    /**
+     * @brief Read-only Polyglot book. The file is memory mapped and searched in place, so any
+     * number of processes can share one copy through the page cache.
+     */
+    class Book {
+    public:
+        static constexpr std::size_t ENTRY_SIZE = 16;
+
+        Book() = default;
+
+        explicit Book(const std::string& path) { open(path); }
+
+        /**
+         * @brief Opens a book file, closing the current one.
+         * @param path
+         * @return false if the file cannot be read or is not a sequence of entries
+         */
+        bool open(const std::string& path) {
+            file_ = std::make_unique<chess::detail::MappedFile>(path);
+
+            if (file_->data().empty() || file_->data().size() % ENTRY_SIZE != 0) {
+                close();
+                return false;
+            }
+
+            return true;
+        }
+
+        void close() noexcept { file_.reset(); }
+
+        [[nodiscard]] bool isOpen() const noexcept { return file_ != nullptr; }
+
+        /**
+         * @brief Number of entries in the book.
+         * @return
+         */
+        [[nodiscard]] std::size_t size() const noexcept { return file_ ? file_->data().size() / ENTRY_SIZE : 0; }
+
+        /**
+         * @brief Returns the book entries of the position, in book order.
+         * @param board
+         * @return
+         */
+        [[nodiscard]] std::vector<Entry> probe(const Board& board) const {
+            std::vector<Entry> entries;
+            const auto k = key(board);
+
+            // binary search for the first entry with the key
+            std::size_t lo = 0, hi = size();
+            while (lo < hi) {
+                const auto mid = lo + (hi - lo) / 2;
+                if (read<std::uint64_t>(mid, 0) < k)
+                    lo = mid + 1;
+                else
+                    hi = mid;
+            }
+
+            for (; lo < size() && read<std::uint64_t>(lo, 0) == k; lo++) {
+                entries.push_back({k, read<std::uint16_t>(lo, 8), read<std::uint16_t>(lo, 10), read<std::uint32_t>(lo, 12)});
+            }
+
+            return entries;
+        }
+
+        /**
+         * @brief Picks a book move with probability proportional to its weight.
+         * @param board
+         * @param random uniformly distributed random number
+         * @return Move::NO_MOVE if the position is not in the book or has no playable move
+         */
+        [[nodiscard]] Move pick(const Board& board, std::uint64_t random) const {
+            const auto entries = probe(board);
+
+            std::uint64_t total = 0;
+            for (const auto& entry : entries) total += entry.weight;
+
+            if (total == 0) return Move::NO_MOVE;
+
+            auto choice = random % total;
+
+            for (const auto& entry : entries) {
+                if (choice < entry.weight) return decode(board, entry.move);
+                choice -= entry.weight;
+            }
+
+            return Move::NO_MOVE;
+        }
+
+    private:
+        template <typename T>
+        [[nodiscard]] T read(std::size_t index, std::size_t offset) const noexcept {
+            const auto* bytes = reinterpret_cast<const unsigned char*>(file_->data().data() + index * ENTRY_SIZE + offset);
+
+            T value = 0;
+            for (std::size_t i = 0; i < sizeof(T); i++) value = static_cast<T>(value << 8 | bytes[i]);
+
+            return value;
+        }
+
+        std::unique_ptr<chess::detail::MappedFile> file_;
+    };
+}  // namespace chess::polyglot
+
 #endif
@@ -1,6 +1,27 @@
 #include <sstream>
 #include <chrono>
+#include <cmath>
+#include <cstdio>
+#include <cstdlib>
+#include <filesystem>
+#include <atomic>
+#include <algorithm>
+#include <fstream>
+#include <functional>
+#include <iomanip>
+#include <memory>
+#include <mutex>
+#include <random>
+#include <thread>
+#include <vector>
 #include "chess.hpp"
+#include "training_data.hpp"
+#include "tablebase.hpp"
+#include "analysis_cache.hpp"
+
+#if defined(_MSC_VER)
+#include <xmmintrin.h>
+#endif
 
 using namespace chess;
 
@@ -39,7 +60,311 @@ static constexpr int phase_limit = 30;
 static constexpr int flip_const = 56;
 static constexpr int eval_limit = 31800;
 
-static int64_t nodes = 0;
+// Orders captures before quiet moves
+static constexpr int capture_bonus = 10000;
+
+// Search counters and limits, per thread so datagen can run searches side by side
+static thread_local int64_t nodes = 0;
+static thread_local int64_t node_limit = INT64_MAX;
+static thread_local int64_t next_check = 0;
+static thread_local std::chrono::steady_clock::time_point deadline = std::chrono::steady_clock::time_point::max();
+static thread_local bool stopped = false;
+
+// Set by the UCI thread to end the running search
+static std::atomic<bool> stop_requested = false;
+
+static constexpr int max_depth = 128;
+
+// Search statistics, compiled in with -DSTATS and out completely otherwise
+#ifdef STATS
+static constexpr bool stats_enabled = true;
+#else
+static constexpr bool stats_enabled = false;
+#endif
+
+struct SearchStats
+{
+    int64_t nodes = 0;
+    int64_t qnodes = 0;
+    int64_t tt_probes = 0;
+    int64_t tt_hits = 0;
+    int64_t tt_cutoffs = 0;
+    int64_t beta_cutoffs = 0;
+    int64_t first_move_cutoffs = 0;
+    int64_t null_searches = 0;
+    int64_t null_cutoffs = 0;
+    int64_t lmr_searches = 0;
+    int64_t lmr_researches = 0;
+    int64_t rfp_prunes = 0;
+    int64_t razor_prunes = 0;
+    int64_t futility_prunes = 0;
+    int64_t delta_prunes = 0;
+
+    void add(const SearchStats& other)
+    {
+        nodes += other.nodes;
+        qnodes += other.qnodes;
+        tt_probes += other.tt_probes;
+        tt_hits += other.tt_hits;
+        tt_cutoffs += other.tt_cutoffs;
+        beta_cutoffs += other.beta_cutoffs;
+        first_move_cutoffs += other.first_move_cutoffs;
+        null_searches += other.null_searches;
+        null_cutoffs += other.null_cutoffs;
+        lmr_searches += other.lmr_searches;
+        lmr_researches += other.lmr_researches;
+        rfp_prunes += other.rfp_prunes;
+        razor_prunes += other.razor_prunes;
+        futility_prunes += other.futility_prunes;
+        delta_prunes += other.delta_prunes;
+    }
+};
+
+// Counted by each thread without atomics and added to the totals when its search ends
+static thread_local SearchStats thread_stats;
+static SearchStats total_stats;
+static std::mutex stats_mutex;
+
+static inline void stat(int64_t SearchStats::*counter)
+{
+    if constexpr (stats_enabled) ++(thread_stats.*counter);
+}
+
+static void print_stats(const SearchStats& s)
+{
+    const auto percent = [](const int64_t part, const int64_t whole) { return whole > 0 ? 100.0 * static_cast<double>(part) / static_cast<double>(whole) : 0.0; };
+
+    std::ostringstream info;
+    info << std::fixed << std::setprecision(1)
+         << "info string stats nodes " << s.nodes
+         << " qnodes " << percent(s.qnodes, s.nodes) << "%"
+         << " tthit " << percent(s.tt_hits, s.tt_probes) << "%"
+         << " ttcut " << s.tt_cutoffs
+         << " firstcut " << percent(s.first_move_cutoffs, s.beta_cutoffs) << "%"
+         << " nullcut " << percent(s.null_cutoffs, s.null_searches) << "%"
+         << " lmrresearch " << percent(s.lmr_researches, s.lmr_searches) << "%"
+         << " rfp " << s.rfp_prunes
+         << " razor " << s.razor_prunes
+         << " futility " << s.futility_prunes
+         << " delta " << s.delta_prunes;
+    std::cout << info.str() << std::endl;
+}
+
+// Time kept back for the GUI and pipes, in milliseconds
+static constexpr int64_t move_overhead = 20;
+
+
+// Transposition table bound types
+enum Bound : uint8_t { BOUND_NONE, BOUND_UPPER, BOUND_LOWER, BOUND_EXACT };
+
+struct TTData
+{
+    Move move;
+    int score;
+    int depth;
+    Bound bound;
+};
+
+// Entries are packed into 64 bits so they are read and written atomically:
+// key 16 | move 16 | score 16 | depth 8 | bound 2 + age 6
+class TranspositionTable
+{
+public:
+    void resize(const size_t mb)
+    {
+        // Round down to a power of two so the bucket index is a mask
+        count = 1;
+        while (count * 2 * sizeof(Bucket) <= mb * 1024 * 1024) count *= 2;
+
+        buckets = std::make_unique<Bucket[]>(count);
+        clear();
+    }
+
+    void clear()
+    {
+        for (size_t i = 0; i < count; ++i)
+            for (std::atomic<uint64_t>& entry : buckets[i].entries) entry.store(0, std::memory_order_relaxed);
+
+        age = 0;
+    }
+
+    void new_search() { age = (age + 1) & 63; }
+
+    // Fetch the bucket into cache ahead of the probe
+    void prefetch(const uint64_t key) const
+    {
+#if defined(__GNUC__)
+        __builtin_prefetch(&bucket(key));
+#elif defined(_MSC_VER)
+        _mm_prefetch(reinterpret_cast<const char*>(&bucket(key)), _MM_HINT_T0);
+#endif
+    }
+
+    bool probe(const uint64_t key, TTData& data) const
+    {
+        for (const std::atomic<uint64_t>& entry : bucket(key).entries)
+        {
+            const uint64_t e = entry.load(std::memory_order_relaxed);
+
+            if ((e & 0xFFFF) == key >> 48 && (e >> 56 & 3) != BOUND_NONE)
+            {
+                data = { Move(static_cast<uint16_t>(e >> 16)), static_cast<int16_t>(e >> 32), static_cast<int>(e >> 48 & 0xFF), static_cast<Bound>(e >> 56 & 3) };
+                return true;
+            }
+        }
+
+        return false;
+    }
+
+    void store(const uint64_t key, Move move, const int score, const int depth, const Bound bound)
+    {
+        Bucket& b = bucket(key);
+        std::atomic<uint64_t>* replace = &b.entries[0];
+        int worst = INT32_MAX;
+
+        for (std::atomic<uint64_t>& entry : b.entries)
+        {
+            const uint64_t e = entry.load(std::memory_order_relaxed);
+
+            // Same position, keep the old move if there is no new one
+            if ((e & 0xFFFF) == key >> 48)
+            {
+                if (move == Move::NO_MOVE) move = Move(static_cast<uint16_t>(e >> 16));
+                replace = &entry;
+                break;
+            }
+
+            // Otherwise replace the shallowest entry, older searches count as shallower
+            const int value = static_cast<int>(e >> 48 & 0xFF) - 8 * ((age - static_cast<int>(e >> 58)) & 63);
+            if (value < worst) worst = value, replace = &entry;
+        }
+
+        replace->store((key >> 48) | uint64_t(move.move()) << 16 | uint64_t(static_cast<uint16_t>(score)) << 32 | uint64_t(depth & 0xFF) << 48 | uint64_t(bound) << 56 | uint64_t(age) << 58, std::memory_order_relaxed);
+    }
+
+    // File layout: "BWTT" | version 32 | bucket count 64 | age 32 | buckets as raw entries
+    bool save(const std::string& path) const
+    {
+        std::ofstream out(path, std::ios::binary);
+        const uint64_t file_buckets = count;
+        const uint32_t file_age = static_cast<uint32_t>(age);
+
+        out.write("BWTT", 4);
+        out.write(reinterpret_cast<const char*>(&file_version), 4);
+        out.write(reinterpret_cast<const char*>(&file_buckets), 8);
+        out.write(reinterpret_cast<const char*>(&file_age), 4);
+
+        // Copied out of the atomics in 1 MB blocks, each written at once
+        std::vector<uint64_t> block;
+
+        for (size_t begin = 0; begin < count && out; begin += block_buckets)
+        {
+            const size_t end = std::min(count, begin + block_buckets);
+            block.clear();
+
+            for (size_t i = begin; i < end; ++i)
+                for (const std::atomic<uint64_t>& entry : buckets[i].entries) block.push_back(entry.load(std::memory_order_relaxed));
+
+            out.write(reinterpret_cast<const char*>(block.data()), static_cast<std::streamsize>(block.size() * sizeof(uint64_t)));
+        }
+
+        out.close();
+        return static_cast<bool>(out);
+    }
+
+    // Only a file of the table's own size is loaded, Hash is never changed behind the user's back;
+    // file_mb is the size of the file's table once its header has been read
+    bool load(const std::string& path, size_t& file_mb)
+    {
+        std::ifstream in(path, std::ios::binary);
+        char magic[4] = {};
+        uint32_t version = 0;
+        uint64_t file_buckets = 0;
+        uint32_t file_age = 0;
+
+        in.read(magic, 4);
+        in.read(reinterpret_cast<char*>(&version), 4);
+        in.read(reinterpret_cast<char*>(&file_buckets), 8);
+        in.read(reinterpret_cast<char*>(&file_age), 4);
+
+        file_mb = 0;
+        if (!in || std::string(magic, 4) != "BWTT" || version != file_version || file_buckets == 0 || (file_buckets & (file_buckets - 1)) != 0) return false;
+
+        // The entries must be exactly the rest of the file
+        const std::streamoff header_end = in.tellg();
+        in.seekg(0, std::ios::end);
+        if (static_cast<uint64_t>(in.tellg() - header_end) != file_buckets * sizeof(Bucket)) return false;
+        in.seekg(header_end);
+
+        file_mb = static_cast<size_t>(file_buckets * sizeof(Bucket) / (1024 * 1024));
+        if (file_buckets != count) return false;
+
+        std::vector<uint64_t> block;
+
+        for (size_t begin = 0; begin < count; begin += block_buckets)
+        {
+            const size_t end = std::min(count, begin + block_buckets);
+            block.resize((end - begin) * entries_per_bucket);
+
+            if (!in.read(reinterpret_cast<char*>(block.data()), static_cast<std::streamsize>(block.size() * sizeof(uint64_t))))
+            {
+                clear();
+                return false;
+            }
+
+            for (size_t i = begin; i < end; ++i)
+                for (size_t j = 0; j < entries_per_bucket; ++j) buckets[i].entries[j].store(block[(i - begin) * entries_per_bucket + j], std::memory_order_relaxed);
+        }
+
+        age = static_cast<int>(file_age & 63);
+        return true;
+    }
+
+private:
+    static constexpr uint32_t file_version = 1;
+    static constexpr size_t entries_per_bucket = 8;
+    static constexpr size_t block_buckets = (1 << 20) / 64;
+
+    // 8 entries fill one cache line
+    struct alignas(64) Bucket { std::atomic<uint64_t> entries[entries_per_bucket]; };
+
+    Bucket& bucket(const uint64_t key) const { return buckets[key & (count - 1)]; }
+
+    std::unique_ptr<Bucket[]> buckets;
+    size_t count = 0;
+    int age = 0;
+};
+
+static TranspositionTable tt;
+static size_t hash_mb = 16;
+
+// The table searches use, epdtest gives every thread its own so results do not depend on scheduling
+static thread_local TranspositionTable* search_tt = &tt;
+
+// Opening book, played from in go when OwnBook is set
+static polyglot::Book book;
+static bool own_book = false;
+
+// Endgame tablebases, probed in searches started by go when TablebasePath is set
+static tablebase::Tablebases tablebases;
+
+// Results of earlier runs, probed at the first plies and written back from searches of at least cache_depth
+static AnalysisCache analysis_cache;
+static size_t analysis_cache_mb = 256;
+static int cache_depth = 12;
+static constexpr int cache_plies = 2;
+
+// Whether the search uses results kept outside it, the analysis cache and the tablebases,
+// only go turns it on, so bench, epdtest and datagen search the same tree on every setup
+static thread_local bool use_stored_results = false;
+
+// Tablebase wins score below mates found by the search, less the distance so shorter wins are preferred
+static constexpr int tb_win_score = eval_limit - 1000;
+
+// Tablebase scores count plies from the root, the table and the cache keep them counted from the position
+static inline bool is_tb_score(const int score) { return std::abs(score) > tb_win_score - 1000 && std::abs(score) <= tb_win_score; }
+static inline int score_to_stored(const int score, const int ply) { return !is_tb_score(score) ? score : score > 0 ? score + ply : score - ply; }
+static inline int score_from_stored(const int score, const int ply) { return !is_tb_score(score) ? score : score > 0 ? score - ply : score + ply; }
 
 
 static inline int evaluate(const Board& board)
@@ -88,32 +413,43 @@ static inline int evaluate(const Board& board)
 }
 
 
-static inline int mvv_lva(const Board& board, const Move& move) { return piece_values[board.at(move.to()).type()] - piece_values[board.at(move.from()).type()]; }
+static inline int mvv_lva(const Board& board, const Move& move)
+{
+    // En passant captures a pawn on an empty square
+    const PieceType victim = move.typeOf() == Move::ENPASSANT ? PieceType(PieceType::PAWN) : board.at(move.to()).type();
+    return piece_values[victim] - piece_values[board.at(move.from()).type()];
+}
 
 
 static int quiesce(int alpha, const int beta, Board& board)
 {
     ++nodes;
+    stat(&SearchStats::qnodes);
 
     int best = evaluate(board);
 
     if (best >= beta) return best;
 
     // Delta pruning
-    if (best + 200 < alpha) return alpha;
+    if (best + 200 < alpha)
+    {
+        stat(&SearchStats::delta_prunes);
+        return alpha;
+    }
 
     if (best > alpha) alpha = best;
 
-    // Get captures
+    // Get captures scored by MVV-LVA, legality is checked lazily
     Movelist captures;
-    movegen::legalmoves<movegen::MoveGenType::CAPTURE>(captures, board);
+    movegen::pseudolegalmoves<movegen::MoveGenType::CAPTURE>(captures, board, [&](const Move& i) { return mvv_lva(board, i); });
 
-    // Order captures by MVV-LVA
-    std::sort(captures.begin(), captures.end(), [&](const Move& i, const Move& j) { return mvv_lva(board, i) > mvv_lva(board, j); });
-
-    // Loop through all captures
-    for (const Move& i : captures)
+    // Loop through all captures, picking the best remaining one lazily as most nodes cut off early
+    for (int k = 0; k < captures.size(); ++k)
     {
+        const Move i = captures.pickBest(k);
+
+        if (!board.isLegal(i)) continue;
+
         board.makeMove(i);
         const int score = -quiesce(-beta, -alpha, board);
         board.unmakeMove(i);
@@ -149,19 +485,86 @@ static inline int order_pst(const Board& board, const int phase, const int flip,
 }
 
 
-static int negamax(int alpha, const int beta, const int depth, Board& board, std::vector<Move>& pv)
+// Stores in the table, and in the analysis cache near the root of deep searches
+static inline void store_result(const uint64_t key, const Move move, const int score, const int depth, const int ply, const Bound bound)
+{
+    const int stored = score_to_stored(score, ply);
+    search_tt->store(key, move, stored, depth, bound);
+
+    if (use_stored_results && ply <= cache_plies && depth >= cache_depth && analysis_cache.isOpen())
+        analysis_cache.store(key, { move.move(), static_cast<int16_t>(stored), static_cast<uint8_t>(depth), static_cast<uint8_t>(bound) });
+}
+
+
+static int negamax(int alpha, const int beta, const int depth, const int ply, Board& board, std::vector<Move>& pv)
 {
     ++nodes;
 
+    // Out of nodes or time or told to stop, the unfinished iteration is thrown away
+    // The clock and the stop flag are only looked at every 1024 nodes
+    if (nodes >= node_limit) stopped = true;
+
+    if (nodes >= next_check)
+    {
+        next_check = nodes + 1024;
+        if (stop_requested.load(std::memory_order_relaxed) || std::chrono::steady_clock::now() >= deadline) stopped = true;
+    }
+
+    if (stopped) return 0;
+
     // eval_limit evaluation if checkmate occurs at 50-move rule or 0 evaluation if 50-move rule
     if (board.isHalfMoveDraw()) return board.getHalfMoveDrawType().first == GameResultReason::CHECKMATE ? -eval_limit : 0;
 
     // 0 evaluation if threefold repetition or insufficient material
-    if (board.isRepetition(1) || board.isInsufficientMaterial()) return 0;
+    // A repetition at the root still needs a move to be played
+    if ((ply > 0 && board.isRepetition(1)) || board.isInsufficientMaterial()) return 0;
+
+    // The side to move can force a repetition, so the score is at least a draw
+    if (ply > 0 && alpha < 0 && board.hasUpcomingRepetition(ply))
+    {
+        alpha = 0;
+        if (alpha >= beta) return alpha;
+    }
+
+    // Exact result from the tablebases, the root still searches for a move
+    tablebase::ProbeResult tb_result;
+    if (use_stored_results && ply > 0 && board.occ().count() <= tablebases.maxMen() && tablebases.probe(board, tb_result))
+    {
+        if (tb_result.wdl == tablebase::Wdl::DRAW) return 0;
+        const int score = tb_win_score - tb_result.dtc - ply;
+        return tb_result.wdl == tablebase::Wdl::WIN ? score : -score;
+    }
 
     // Quiesce if depth is 0
     if (depth == 0) return quiesce(alpha, beta, board);
 
+    const int alpha_orig = alpha;
+    TTData tt_data = { Move(Move::NO_MOVE), 0, 0, BOUND_NONE };
+    bool tt_hit = search_tt->probe(board.hash(), tt_data);
+    if (tt_hit) tt_data.score = score_from_stored(tt_data.score, ply);
+    stat(&SearchStats::tt_probes);
+    if (tt_hit) stat(&SearchStats::tt_hits);
+
+    // A deeper result from an earlier run takes the place of the table entry
+    AnalysisCache::Entry cached;
+    if (use_stored_results && ply <= cache_plies && (!tt_hit || tt_data.depth < depth) && analysis_cache.probe(board.hash(), cached) && cached.depth >= depth)
+    {
+        tt_data = { Move(cached.move), score_from_stored(cached.score, ply), cached.depth, static_cast<Bound>(cached.bound) };
+        tt_hit = true;
+    }
+
+    // Transposition table cutoff, not at the root so a move is always returned
+    if (ply > 0 && tt_hit && tt_data.depth >= depth)
+    {
+        if (tt_data.bound == BOUND_EXACT
+            || (tt_data.bound == BOUND_LOWER && tt_data.score >= beta)
+            || (tt_data.bound == BOUND_UPPER && tt_data.score <= alpha))
+        {
+            stat(&SearchStats::tt_cutoffs);
+            return tt_data.score;
+        }
+    }
+
     // Null move pruning
     if (!board.inCheck() && depth >= 4)
     {
@@ -169,10 +572,15 @@ static int negamax(int alpha, const int beta, const int depth, Board& board, std
         r = std::min(r, depth - 1);
 
         board.makeNullMove();
-        const int score = -negamax(-beta, -beta + 1, depth - r, board, pv);
+        const int score = -negamax(-beta, -beta + 1, depth - r, ply + 1, board, pv);
         board.unmakeNullMove();
+        stat(&SearchStats::null_searches);
 
-        if (score >= beta) return score;
+        if (score >= beta)
+        {
+            stat(&SearchStats::null_cutoffs);
+            return score;
+        }
     }
 
     const bool depth1 = (depth == 1);
@@ -183,94 +591,84 @@ static int negamax(int alpha, const int beta, const int depth, Board& board, std
         evaluation = evaluate(board);
     
         // Reverse futility pruning
-        if (evaluation - 150 >= beta) return evaluation;
+        if (evaluation - 150 >= beta)
+        {
+            stat(&SearchStats::rfp_prunes);
+            return evaluation;
+        }
     
         // Razoring
-        if (evaluation + 300 <= alpha) return quiesce(alpha, beta, board);
-    }
-
-    // Get moves
-    Movelist moves;
-    movegen::legalmoves<movegen::MoveGenType::ALL>(moves, board);
-
-    // eval_limit evaluation if checkmate or 0 evaluation if stalemate
-    if (moves.empty()) return board.inCheck() ? -eval_limit : 0;
-
-    int loc = 0;
-
-    // Order PV move first
-    if (!pv.empty())
-    {
-        const Movelist::iterator it = std::find(moves.begin(), moves.end(), pv[0]);
-        if (it != moves.end()) std::swap(*it, moves[loc]), loc++;
-    }
-
-    // Get iterator to separate captures and quiet moves
-    const Movelist::iterator it = std::stable_partition(moves.begin() + loc, moves.end(), [&](const Move& i) { return board.isCapture(i); });
-
-    // Order captures first by MVV-LVA
-    std::sort(moves.begin() + loc, it, [&](const Move& i, const Move& j) { return mvv_lva(board, i) > mvv_lva(board, j); });
-
-    // King not included in phase
-    int phase = -2;
-
-    // Loop through all piece types
-    for (const PieceType& i : piece_types)
-    {
-        // Get pieces
-        Bitboard wp = board.pieces(i, Color::WHITE);
-        Bitboard bp = board.pieces(i, Color::BLACK);
-
-        // Add number of pieces to phase
-        phase += wp.count() + bp.count();
+        if (evaluation + 300 <= alpha)
+        {
+            stat(&SearchStats::razor_prunes);
+            return quiesce(alpha, beta, board);
+        }
     }
 
-    // Get flip
-    const int flip = board.sideToMove() == Color::WHITE ? 0 : flip_const;
-
-    // Order quiet moves by PST
-    std::sort(it, moves.end(), [&](const Move& i, const Move& j) { return order_pst(board, phase, flip, i) > order_pst(board, phase, flip, j); });
-
     int move_count = 0;
     std::vector<Move> child_pv;
     int best = -eval_limit;
+    Move best_move = Move::NO_MOVE;
 
-    // Loop through all moves
-    for (const Move& i : moves)
+    // Search a move, returns true on a beta cutoff
+    const auto search_move = [&](const Move& i)
     {
         ++move_count;
         child_pv.clear();
         int score = 0;
 
+        // Checking moves are neither pruned nor reduced
+        const bool check = board.givesCheck(i) != CheckType::NO_CHECK;
+
         // Futility pruning
-        if (depth1 && evaluation + 300 <= alpha) continue;
+        if (depth1 && !check && evaluation + 300 <= alpha)
+        {
+            stat(&SearchStats::futility_prunes);
+            return false;
+        }
+
+        // Start loading the child's table entry while the move is made
+        search_tt->prefetch(board.keyAfter(i));
 
         board.makeMove(i);
 
         // Late move reduction
-        if (depth >= 2)
+        if (depth >= 2 && !check)
         {
             int r = static_cast<int>(std::round(1 + log(depth) * log(move_count) / 3));
             r = std::min(r, depth - 1);
-            score = -negamax(-beta, -alpha, depth - 1 - r, board, child_pv);
+            score = -negamax(-beta, -alpha, depth - 1 - r, ply + 1, board, child_pv);
+            stat(&SearchStats::lmr_searches);
 
-            if (score > alpha) { score = -negamax(-beta, -alpha, depth - 1, board, child_pv); }
+            if (score > alpha)
+            {
+                stat(&SearchStats::lmr_researches);
+                score = -negamax(-beta, -alpha, depth - 1, ply + 1, board, child_pv);
+            }
         }
         
-        else { score = -negamax(-beta, -alpha, depth - 1, board, child_pv); }
+        else { score = -negamax(-beta, -alpha, depth - 1, ply + 1, board, child_pv); }
         
         board.unmakeMove(i);
 
+        if (stopped) return true;
+
         if (score >= beta)
         {
+            stat(&SearchStats::beta_cutoffs);
+            if (move_count == 1) stat(&SearchStats::first_move_cutoffs);
+
             pv = child_pv;
             pv.insert(pv.begin(), i);
-            return score;
+            best = score;
+            best_move = i;
+            return true;
         }
 
         if (score > best)
         {
             best = score;
+            best_move = i;
             if (score > alpha)
             {
                 pv = child_pv;
@@ -278,93 +676,1231 @@ static int negamax(int alpha, const int beta, const int depth, Board& board, std
                 alpha = score;
             }
         }
-    }
 
-    return best;
-}
+        return false;
+    };
 
+    // Search the PV or hash move before generating any moves, a cutoff here saves the generation
+    const Move hint = pv.empty() ? tt_data.move : pv[0];
+    const bool hint_valid = hint != Move::NO_MOVE && board.isPseudoLegal(hint) && board.isLegal(hint);
 
-int main()
-{
-    Board board = Board();
-    std::string input;
+    if (hint_valid && search_move(hint))
+    {
+        if (!stopped) store_result(board.hash(), best_move, best, depth, ply, BOUND_LOWER);
+        return best;
+    }
 
-    while (std::getline(std::cin, input))
+    // King not included in phase
+    int phase = -2;
+
+    // Loop through all piece types
+    for (const PieceType& i : piece_types)
     {
-        std::istringstream iss(input);
-        std::string command;
-        iss >> command;
+        // Get pieces
+        Bitboard wp = board.pieces(i, Color::WHITE);
+        Bitboard bp = board.pieces(i, Color::BLACK);
 
-        if (command == "go")
-        {
-            int depth = 0;
-            std::vector<Move> pv;
-            const std::chrono::time_point<std::chrono::steady_clock> start_time = std::chrono::steady_clock::now();
-            nodes = 0;
+        // Add number of pieces to phase
+        phase += wp.count() + bp.count();
+    }
 
-            while (true)
-            {
-                ++depth;
+    // Get flip
+    const int flip = board.sideToMove() == Color::WHITE ? 0 : flip_const;
 
-                const int score = negamax(-eval_limit, eval_limit, depth, board, pv);
-                const int64_t time = std::chrono::duration_cast<std::chrono::milliseconds>(std::chrono::steady_clock::now() - start_time).count();
+    // Get moves, legality is checked lazily
+    // Score captures first by MVV-LVA, then quiet moves by PST
+    Movelist moves;
+    movegen::pseudolegalmoves<movegen::MoveGenType::ALL>(moves, board, [&](const Move& i)
+    {
+        return board.isCapture(i) ? capture_bonus + mvv_lva(board, i) : order_pst(board, phase, flip, i);
+    });
 
-                // Multiply by 1000 to convert millisecond to second
-                const int64_t nps = (time > 0 ? nodes * 1000 / time : 0);
+    // Loop through all moves, picking the best remaining one lazily as most nodes cut off early
+    for (int k = 0; k < moves.size(); ++k)
+    {
+        const Move i = moves.pickBest(k);
 
-                std::cout << "info depth " << depth
-                          << " score cp " << score
-                          << " time " << time
-                          << " nodes " << nodes
-                          << " nps " << nps
-                          << " pv";
-                for (const Move& i : pv) std::cout << " " << uci::moveToUci(i);
-                std::cout << std::endl;
-            }
-        }
+        if ((hint_valid && i == hint) || !board.isLegal(i)) continue;
 
-        else if (command == "position")
+        if (search_move(i))
         {
-            std::string subcommand;
-            std::string argument;
-            iss >> subcommand;
+            if (!stopped) store_result(board.hash(), best_move, best, depth, ply, BOUND_LOWER);
+            return best;
+        }
+    }
 
-            if (subcommand == "startpos")
-            {
-                board = Board();
+    // eval_limit evaluation if checkmate or 0 evaluation if stalemate
+    if (move_count == 0) return board.inCheck() ? -eval_limit : 0;
 
-                // Remove "moves" from argument
-                iss >> argument;
-            }
+    store_result(board.hash(), best_move, best, depth, ply, best > alpha_orig ? BOUND_EXACT : BOUND_UPPER);
 
-            else if (subcommand == "fen")
-            {
-                std::string fen;
-                while (iss >> argument && argument != "moves") fen += argument + " ";
-                board = Board(fen);
-            }
+    return best;
+}
 
-            std::vector<std::string> moves;
-            while (iss >> argument) moves.push_back(argument);
 
-            for (const std::string& i : moves)
-            {
-                Move move = uci::uciToMove(board, i);
-                board.makeMove(move);
-            }
-        }
+struct SearchResult
+{
+    Move move;
+    int score;
+    int depth;
+    int64_t nodes;
+    int64_t time;
+};
 
-        else if (command == "quit") break;
+// Times are in milliseconds from the start of the search
+// No new iteration is started after soft_time, the search is stopped at hard_time
+struct SearchLimits
+{
+    int depth = max_depth;
+    int64_t nodes = INT64_MAX;
+    int64_t soft_time = INT64_MAX;
+    int64_t hard_time = INT64_MAX;
+};
 
-        else if (command == "uci")
+// Iterative deepening within the limits, prints info lines if verbose
+// on_iteration is called with the result of every finished iteration
+static SearchResult search(Board& board, const SearchLimits& limits, const bool verbose, const std::function<void(const SearchResult&)>& on_iteration = nullptr)
+{
+    SearchResult result = { Move::NO_MOVE, 0, 0, 0, 0 };
+    std::vector<Move> pv;
+    const std::chrono::time_point<std::chrono::steady_clock> start_time = std::chrono::steady_clock::now();
+    nodes = 0;
+    next_check = 0;
+    stopped = false;
+    if constexpr (stats_enabled) thread_stats = SearchStats();
+
+    const auto report = [&]()
+    {
+        if (on_iteration) on_iteration(result);
+
+        if (verbose)
         {
-            std::cout << "id name BlueWhale-v1-10\n"
-                      << "id author StellarKitten\n"
-                      << "uciok\n";
+            // Multiply by 1000 to convert millisecond to second
+            const int64_t nps = (result.time > 0 ? result.nodes * 1000 / result.time : 0);
+
+            // Written at once so lines do not mix with the UCI thread's output
+            std::ostringstream info;
+            info << "info depth " << result.depth
+                 << " score cp " << result.score
+                 << " time " << result.time
+                 << " nodes " << result.nodes
+                 << " nps " << nps
+                 << " pv";
+            for (const Move& i : pv) info << " " << uci::moveToUci(i);
+            std::cout << info.str() << std::endl;
         }
+    };
+
+    // A root result from an earlier run is reported at once, iterations up to its depth only refill the table
+    AnalysisCache::Entry cached;
+    int cached_depth = 0;
+
+    if (use_stored_results && analysis_cache.probe(board.hash(), cached) && cached.bound == BOUND_EXACT && board.isPseudoLegal(Move(cached.move)) && board.isLegal(Move(cached.move)))
+    {
+        cached_depth = cached.depth;
+        pv = { Move(cached.move) };
+        result = { pv[0], cached.score, cached_depth, 0, 0 };
+        report();
+
+        if (cached_depth >= limits.depth) return result;
+    }
+
+    for (int depth = 1; depth <= limits.depth; ++depth)
+    {
+        // The first iteration always finishes so there is a move to play
+        node_limit = depth == 1 ? INT64_MAX : limits.nodes;
+        deadline = depth == 1 || limits.hard_time == INT64_MAX ? std::chrono::steady_clock::time_point::max() : start_time + std::chrono::milliseconds(limits.hard_time);
 
-        else if (command == "ucinewgame") board = Board();
+        const int score = negamax(-eval_limit, eval_limit, depth, 0, board, pv);
 
-        else if (command == "isready") std::cout << "readyok\n";
+        if (stopped) break;
+
+        const int64_t time = std::chrono::duration_cast<std::chrono::milliseconds>(std::chrono::steady_clock::now() - start_time).count();
+
+        if (depth > cached_depth)
+        {
+            // When every move loses the pv is not updated and may hold a line from the null move search
+            const bool pv_valid = !pv.empty() && board.isPseudoLegal(pv[0]) && board.isLegal(pv[0]);
+            result = { pv_valid ? pv[0] : result.move, score, depth, nodes, time };
+            report();
+        }
+
+        if (time >= limits.soft_time) break;
+    }
+
+    // Stopped during the first iteration, or no move avoided being mated
+    if (result.move == Move::NO_MOVE)
+    {
+        Movelist moves;
+        movegen::legalmoves(moves, board);
+        if (!moves.empty()) result.move = moves[0];
+    }
+
+    if constexpr (stats_enabled)
+    {
+        thread_stats.nodes = nodes;
+        std::lock_guard<std::mutex> lock(stats_mutex);
+        total_stats.add(thread_stats);
+        if (verbose) print_stats(thread_stats);
+    }
+
+    return result;
+}
+
+
+struct DatagenOptions
+{
+    std::string file;
+    int64_t games = 1000;
+    int threads = 1;
+    int64_t nodes = 5000;
+    int random_plies = 8;
+    TrainingFormat format = TrainingFormat::PACKED;
+};
+
+// Self-play adjudication: a score beyond adjudicate_score wins, a game reaching max_game_ply is drawn
+static constexpr int adjudicate_score = 2000;
+static constexpr int max_game_ply = 400;
+static constexpr int max_opening_score = 1000;
+
+// Plays one self-play game and writes its quiet positions, returns the number written,
+// or -1 when the random opening was already decided and another one has to be drawn
+static int64_t play_game(const DatagenOptions& options, std::mt19937_64& rng, TrainingWriter& writer)
+{
+    Board board;
+    Movelist moves;
+
+    // Random opening, started over if the game ends during it
+    for (int i = 0; i < options.random_plies; ++i)
+    {
+        movegen::legalmoves(moves, board);
+
+        if (moves.empty())
+        {
+            board = Board();
+            i = -1;
+            continue;
+        }
+
+        board.makeMove(moves[rng() % moves.size()]);
+    }
+
+    TrainingGame game;
+    game.start = board;
+    game.start_ply = static_cast<uint16_t>(options.random_plies);
+    int64_t quiet = 0;
+
+    for (int ply = 0; ply < max_game_ply; ++ply)
+    {
+        movegen::legalmoves(moves, board);
+
+        // Checkmate or stalemate
+        if (moves.empty())
+        {
+            if (board.inCheck()) game.white_result = board.sideToMove() == Color::WHITE ? -1 : 1;
+            break;
+        }
+
+        // Draws, a repeated position is counted as drawn
+        if (board.isHalfMoveDraw() || board.isRepetition(1) || board.isInsufficientMaterial()) break;
+
+        SearchLimits limits;
+        limits.nodes = options.nodes;
+        const SearchResult result = search(board, limits, false);
+
+        if (result.move == Move::NO_MOVE) break;
+
+        // Skip openings the random moves already decided
+        if (ply == 0 && std::abs(result.score) > max_opening_score) return -1;
+
+        if (std::abs(result.score) >= adjudicate_score)
+        {
+            game.white_result = (result.score > 0) == (board.sideToMove() == Color::WHITE) ? 1 : -1;
+            break;
+        }
+
+        // Only quiet positions are trained on, the score of a tactical one depends on the next moves
+        const bool is_quiet = !board.inCheck() && !board.isCapture(result.move) && result.move.typeOf() != Move::PROMOTION;
+        quiet += is_quiet;
+
+        game.moves.push_back({ result.move, static_cast<int16_t>(result.score), is_quiet });
+        board.makeMove(result.move);
+    }
+
+    if (!game.moves.empty()) writer.write(game);
+
+    return quiet;
+}
+
+// datagen <file> [games <n>] [threads <n>] [nodes <n>] [random <n>] [format packed|chain]
+// Every thread plays games into its own part file with its own hash table, the parts are joined at the end
+static void datagen(const DatagenOptions& options)
+{
+    std::atomic<int64_t> next_game = 0;
+    std::atomic<int64_t> games_done = 0;
+    std::atomic<int64_t> positions = 0;
+    std::atomic<int> running = options.threads;
+    std::vector<std::thread> workers;
+
+    for (int t = 0; t < options.threads; ++t)
+    {
+        workers.emplace_back([&, t]()
+        {
+            TrainingWriter writer(options.file + "." + std::to_string(t), options.format);
+            std::mt19937_64 rng(std::random_device{}() ^ (uint64_t(t) << 32));
+            TranspositionTable table;
+            table.resize(hash_mb);
+            search_tt = &table;
+
+            while (next_game.fetch_add(1) < options.games)
+            {
+                int64_t written;
+
+                do
+                {
+                    table.clear();
+                    written = play_game(options, rng, writer);
+                } while (written < 0);
+
+                positions += written;
+                ++games_done;
+            }
+
+            search_tt = &tt;
+            writer.flush();
+            --running;
+        });
+    }
+
+    const std::chrono::time_point<std::chrono::steady_clock> start_time = std::chrono::steady_clock::now();
+    int64_t last_report = 0;
+
+    while (running > 0)
+    {
+        std::this_thread::sleep_for(std::chrono::milliseconds(100));
+
+        const int64_t time = std::chrono::duration_cast<std::chrono::milliseconds>(std::chrono::steady_clock::now() - start_time).count();
+
+        if (time - last_report >= 10000 || running == 0)
+        {
+            last_report = time;
+            std::cout << "info string datagen games " << games_done << " positions " << positions
+                      << " positions/h " << (time > 0 ? positions * 3600000 / time : 0) << std::endl;
+        }
+    }
+
+    for (std::thread& i : workers) i.join();
+
+    // Join the part files
+    std::ofstream out(options.file, std::ios::binary);
+
+    for (int t = 0; t < options.threads; ++t)
+    {
+        const std::string part = options.file + "." + std::to_string(t);
+        {
+            std::ifstream in(part, std::ios::binary);
+            if (in.peek() != std::ifstream::traits_type::eof()) out << in.rdbuf();
+        }
+        std::remove(part.c_str());
+    }
+
+    if (!out) std::cout << "info string could not write " << options.file << std::endl;
+}
+
+
+// A test position with the moves its bm and am operations name
+struct EpdPosition
+{
+    std::string id;
+    Board board;
+    std::vector<Move> best;
+    std::vector<Move> avoid;
+};
+
+struct EpdResult
+{
+    Move move = Move::NO_MOVE;
+    bool solved = false;
+
+    // Time and nodes of the iteration from which on the move stayed correct
+    int64_t time = 0;
+    int64_t nodes = 0;
+};
+
+// Reads an EPD line with its bm, am and id operations, false if there is nothing to test
+static bool parse_epd(const std::string& line, EpdPosition& position)
+{
+    if (!position.board.setEpd(line)) return false;
+
+    // Operations follow the four position fields and end with semicolons
+    std::istringstream fields(line);
+    std::string field;
+    for (int i = 0; i < 4; ++i) fields >> field;
+
+    std::string operation;
+
+    while (std::getline(fields, operation, ';'))
+    {
+        std::istringstream tokens(operation);
+        std::string opcode, operand;
+        tokens >> opcode;
+
+        if (opcode == "id")
+        {
+            std::getline(tokens >> std::ws, operand);
+            operand.erase(std::remove(operand.begin(), operand.end(), '"'), operand.end());
+            position.id = operand;
+        }
+
+        else if (opcode == "bm" || opcode == "am")
+        {
+            while (tokens >> operand)
+            {
+                try
+                {
+                    (opcode == "bm" ? position.best : position.avoid).push_back(uci::parseSan(position.board, operand));
+                }
+                catch (const std::exception&)
+                {
+                    std::cout << "info string skipping " << opcode << " " << operand << " in " << line << std::endl;
+                }
+            }
+        }
+    }
+
+    return !position.best.empty() || !position.avoid.empty();
+}
+
+static void print_distribution(const std::string& name, std::vector<int64_t> values)
+{
+    if (values.empty()) return;
+
+    std::sort(values.begin(), values.end());
+
+    int64_t sum = 0;
+    for (const int64_t i : values) sum += i;
+
+    const auto percentile = [&](const int p) { return values[(values.size() - 1) * p / 100]; };
+
+    std::cout << name
+              << " min " << values.front()
+              << " p25 " << percentile(25)
+              << " median " << percentile(50)
+              << " p75 " << percentile(75)
+              << " p90 " << percentile(90)
+              << " max " << values.back()
+              << " mean " << sum / static_cast<int64_t>(values.size()) << std::endl;
+}
+
+// epdtest <file> [nodes <n>] [movetime <ms>] [depth <n>] [threads <n>]
+// One position per thread, each thread with its own cleared hash table, so node limited runs repeat exactly
+static void epdtest(const std::string& file, const SearchLimits& limits, const int threads)
+{
+    std::vector<EpdPosition> positions;
+    std::ifstream in(file);
+    std::string line;
+
+    while (std::getline(in, line))
+    {
+        EpdPosition position;
+        if (parse_epd(line, position)) positions.push_back(position);
+    }
+
+    std::vector<EpdResult> results(positions.size());
+    std::atomic<size_t> next = 0;
+    std::vector<std::thread> workers;
+
+    for (int t = 0; t < threads; ++t)
+    {
+        workers.emplace_back([&]()
+        {
+            TranspositionTable table;
+            table.resize(hash_mb);
+            search_tt = &table;
+
+            for (size_t i; (i = next.fetch_add(1)) < positions.size();)
+            {
+                const EpdPosition& position = positions[i];
+                EpdResult& result = results[i];
+                bool solving = false;
+
+                const auto correct = [&](const Move& move)
+                {
+                    return (position.best.empty() || std::find(position.best.begin(), position.best.end(), move) != position.best.end())
+                        && std::find(position.avoid.begin(), position.avoid.end(), move) == position.avoid.end();
+                };
+
+                table.clear();
+                Board board = position.board;
+
+                result.move = search(board, limits, false, [&](const SearchResult& iteration)
+                {
+                    if (!correct(iteration.move)) solving = false;
+
+                    else if (!solving)
+                    {
+                        solving = true;
+                        result.time = iteration.time;
+                        result.nodes = iteration.nodes;
+                    }
+                }).move;
+
+                result.solved = solving && correct(result.move);
+            }
+
+            search_tt = &tt;
+        });
+    }
+
+    for (std::thread& i : workers) i.join();
+
+    // Reported in file order so runs can be diffed
+    std::vector<int64_t> times, node_counts;
+
+    for (size_t i = 0; i < positions.size(); ++i)
+    {
+        const EpdResult& result = results[i];
+
+        std::cout << (result.solved ? "solved " : "failed ")
+                  << (positions[i].id.empty() ? std::to_string(i + 1) : positions[i].id) << " "
+                  << (result.move == Move::NO_MOVE ? "none" : uci::moveToSan(positions[i].board, result.move));
+
+        if (result.solved)
+        {
+            std::cout << " time " << result.time << " nodes " << result.nodes;
+            times.push_back(result.time);
+            node_counts.push_back(result.nodes);
+        }
+
+        std::cout << "\n";
+    }
+
+    std::cout << "solved " << times.size() << " of " << positions.size() << std::endl;
+    print_distribution("time to solution ms", times);
+    print_distribution("nodes to solution", node_counts);
+}
+
+
+// Fixed positions for microbench and bench: openings, middlegames, endgames, checks, promotions and castling
+static const char* const bench_positions[] =
+{
+    "rnbqkbnr/pppppppp/8/8/8/8/PPPPPPPP/RNBQKBNR w KQkq - 0 1",
+    "r3k2r/p1ppqpb1/bn2pnp1/3PN3/1p2P3/2N2Q1p/PPPBBPPP/R3K2R w KQkq - 0 10",
+    "8/2p5/3p4/KP5r/1R3p1k/8/4P1P1/8 w - - 0 11",
+    "4rrk1/pp1n3p/3q2pQ/2p1pb2/2PP4/2P3N1/P2B2PP/4RRK1 b - - 7 19",
+    "rq3rk1/ppp2ppp/1bnpb3/3N2B1/3NP3/7P/PPPQ1PP1/2KR3R w - - 7 14",
+    "r1bq1r1k/1pp1n1pp/1p1p4/4p2Q/4Pp2/1BNP4/PPP2PPP/3R1RK1 w - - 2 14",
+    "r3r1k1/2p2ppp/p1p1bn2/8/1q2P3/2NPQN2/PPP3PP/R4RK1 b - - 2 15",
+    "r1bbk1nr/pp3p1p/2n5/1N4p1/2Np1B2/8/PPP2PPP/2KR1B1R w kq - 0 13",
+    "r1bq1rk1/ppp1nppp/4n3/3p3Q/3P4/1BP1B3/PP1N2PP/R4RK1 w - - 1 16",
+    "4r1k1/r1q2ppp/ppp2n2/4P3/5Rb1/1N1BQ3/PPP3PP/R5K1 w - - 1 17",
+    "2rqkb1r/ppp2p2/2npb1p1/1N1Nn2p/2P1PP2/8/PP2B1PP/R1BQK2R b KQ - 0 11",
+    "r1bq1r1k/b1p1npp1/p2p3p/1p6/3PP3/1B2NN2/PP3PPP/R2Q1RK1 w - - 1 16",
+    "3r1rk1/p5pp/bpp1pp2/8/q1PP1P2/b3P3/P2NQRPP/1R2B1K1 b - - 6 22",
+    "r1q2rk1/2p1bppp/2Pp4/p6b/Q1PNp3/4B3/PP1R1PPP/2K4R w - - 2 18",
+    "4k2r/1pb2ppp/1p2p3/1R1p4/3P4/2r1PN2/P4PPP/1R4K1 b - - 3 22",
+    "3q2k1/pb3p1p/4pbp1/2r5/PpN2N2/1P2P2P/5PP1/Q2R2K1 b - - 4 26",
+    "6k1/6p1/6Pp/ppp5/3pn2P/1P3K2/1PP2P2/3N4 b - - 0 1",
+    "3b4/5kp1/1p1p1p1p/pP1PpP1P/P1P1P3/3KN3/8/8 w - - 0 1",
+    "2K5/p7/7P/5pR1/8/5k2/r7/8 w - - 0 1",
+    "8/6pk/1p6/8/PP3p1p/5P2/4KP1q/3Q4 w - - 0 1",
+    "7k/3p2pp/4q3/8/4Q3/5Kp1/P6b/8 w - - 0 1",
+    "8/2p5/8/2kPKp1p/2p4P/2P5/3P4/8 w - - 0 1",
+    "8/1p3pp1/7p/5P1P/2k3P1/8/2K2P2/8 w - - 0 1",
+    "8/pp2r1k1/2p1p3/3pP2p/1P1P1P1P/P5KR/8/8 w - - 0 1",
+    "8/3p4/p1bk3p/Pp6/1Kp1PpPp/2P2P1P/2P5/5B2 b - - 0 1",
+    "5k2/7R/4P2p/5K2/p1r2P1p/8/8/8 b - - 0 1",
+    "6k1/6p1/P6p/r1N5/5p2/7P/1b3PP1/4R1K1 w - - 0 1",
+    "1r3k2/4q3/2Pp3b/3Bp3/2Q2p2/1p1P2P1/1P2KP2/3N4 w - - 0 1",
+    "6k1/4pp1p/3p2p1/P1pPb3/R7/1r2P1PP/3B1P2/6K1 w - - 0 1",
+    "8/3p3B/5p2/5P2/p7/PP5b/k7/6K1 w - - 0 1",
+    "5rk1/q6p/2p3bR/1pPp1rP1/1P1Pp3/P3B1Q1/1K3P2/R7 w - - 93 90",
+    "4rrk1/1p1nq3/p7/2p1P1pp/3P2bp/3Q1Bn1/PPPB4/1K2R1NR w - - 40 21",
+    "r3k2r/3nnpbp/q2pp1p1/p7/Pp1PPPP1/4BNN1/1P5P/R2Q1RK1 w kq - 0 16",
+    "3Qb1k1/1r2ppb1/pN1n2q1/Pp1Pp1Pr/4P2p/4BP2/4B1R1/1R5K b - - 11 40",
+    "4k3/3q1r2/1N2r1b1/3ppN2/2nPP3/1B1R2n1/2R1Q3/3K4 w - - 5 1",
+    "8/8/8/8/5kp1/P7/8/1K1N4 w - - 0 1",
+    "8/8/8/5N2/8/p7/8/2NK3k w - - 0 1",
+    "8/3k4/8/8/8/4B3/4KB2/2B5 w - - 0 1",
+    "8/8/1P6/5pr1/8/4R3/7k/2K5 w - - 0 1",
+    "8/2p4P/8/kr6/6R1/8/8/1K6 w - - 0 1",
+    "8/8/3P3k/8/1p6/8/1P6/1K3n2 b - - 0 1",
+    "8/R7/2q5/8/6k1/8/1P5p/K6R w - - 0 124",
+    "6k1/3b3r/1p1p4/p1n2p2/1PPNpP1q/P3Q1p1/1R1RB1P1/5K2 b - - 0 1",
+    "r2r1n2/pp2bk2/2p1p2p/3q4/3PN1QP/2P3R1/P4PP1/5RK1 w - - 0 1",
+    "8/8/8/8/8/6k1/6p1/6K1 w - - 0 1",
+    "7k/7P/6K1/8/3B4/8/8/8 b - - 0 1",
+    "bb1n1rkr/ppp1Q1pp/3n1p2/3p4/3P4/8/PPPq1PPP/BB1NNRKR w - - 0 9",
+    "rnbqkb1r/pppp1ppp/5n2/4p3/4P3/5N2/PPPP1PPP/RNBQKB1R w KQkq - 2 3",
+    "r1bqkb1r/pppp1ppp/2n2n2/4p2Q/2B1P3/8/PPPP1PPP/RNB1K1NR w KQkq - 4 4",
+    "rnbqkbnr/ppp1p1pp/8/3pPp2/8/8/PPPP1PPP/RNBQKBNR w KQkq f6 0 3"
+};
+
+// Time per call in nanoseconds of one benchmark over a number of timed passes
+struct MicroResult
+{
+    std::string name;
+    int64_t calls;
+    std::vector<double> ns;
+};
+
+// Runs pass() for warmup passes, scales the pass to at least 10 ms, then times runs passes
+// pass(reps) makes reps rounds over the positions and returns the number of calls it made
+template <typename Pass>
+static MicroResult measure(const std::string& name, const int runs, Pass&& pass)
+{
+    using clock = std::chrono::steady_clock;
+    int reps = 1;
+
+    for (int warmup = 0; warmup < 3; ++warmup)
+    {
+        const clock::time_point start = clock::now();
+        pass(reps);
+        const int64_t us = std::chrono::duration_cast<std::chrono::microseconds>(clock::now() - start).count();
+
+        if (us < 10000) reps = static_cast<int>(std::min<int64_t>(1 << 20, reps * (10000 / std::max<int64_t>(1, us) + 1)));
+    }
+
+    MicroResult result = { name, 0, {} };
+
+    for (int run = 0; run < runs; ++run)
+    {
+        const clock::time_point start = clock::now();
+        const int64_t calls = pass(reps);
+        const int64_t ns = std::chrono::duration_cast<std::chrono::nanoseconds>(clock::now() - start).count();
+
+        result.calls = calls;
+        result.ns.push_back(static_cast<double>(ns) / static_cast<double>(std::max<int64_t>(1, calls)));
+    }
+
+    std::sort(result.ns.begin(), result.ns.end());
+    return result;
+}
+
+// microbench [runs <n>] [file <json>]
+// Times the board primitives over bench_positions and writes the per call times as JSON
+static void microbench(const int runs, const std::string& file)
+{
+    std::vector<Board> boards;
+    std::vector<std::vector<Move>> legal;
+    std::vector<std::vector<std::string>> uci_moves;
+
+    for (const char* fen : bench_positions)
+    {
+        boards.emplace_back(fen);
+
+        Movelist moves;
+        movegen::legalmoves(moves, boards.back());
+        legal.emplace_back(moves.begin(), moves.end());
+
+        uci_moves.emplace_back();
+        for (const Move& i : moves) uci_moves.back().push_back(uci::moveToUci(i));
+    }
+
+    std::vector<PackedBoard> packed;
+    for (const Board& i : boards) packed.push_back(Board::Compact::encode(i));
+
+    // The positions after a fixed line of quiet piece moves, so isRepetition has a history to scan
+    std::vector<Board> played = boards;
+    for (Board& board : played)
+    {
+        for (int ply = 0; ply < 8; ++ply)
+        {
+            Movelist moves;
+            movegen::legalmoves(moves, board);
+            if (moves.empty()) break;
+
+            const auto quiet = std::find_if(moves.begin(), moves.end(), [&](const Move& m) { return !board.isCapture(m) && board.at<PieceType>(m.from()) != PieceType::PAWN; });
+            board.makeMove(quiet != moves.end() ? *quiet : moves[0]);
+        }
+    }
+
+    // Every result feeds the sink, so the compiler cannot drop the calls
+    uint64_t sink = 0;
+    std::vector<MicroResult> results;
+
+    results.push_back(measure("evaluate", runs, [&](const int reps)
+    {
+        for (int r = 0; r < reps; ++r)
+            for (const Board& i : boards) sink += static_cast<uint64_t>(evaluate(i));
+        return int64_t(reps) * static_cast<int64_t>(boards.size());
+    }));
+
+    // Generated right after makeMove, so every call computes the checkers and pins the board caches;
+    // the time includes that make and unmake, make_unmake below measures them alone
+    results.push_back(measure("legalmoves_all", runs, [&](const int reps)
+    {
+        Movelist moves;
+        int64_t calls = 0;
+        for (int r = 0; r < reps; ++r)
+        {
+            for (size_t i = 0; i < boards.size(); ++i)
+            {
+                if (legal[i].empty()) continue;
+
+                boards[i].makeMove(legal[i][0]);
+                movegen::legalmoves<movegen::MoveGenType::ALL>(moves, boards[i]), sink += moves.size();
+                boards[i].unmakeMove(legal[i][0]);
+                ++calls;
+            }
+        }
+        return calls;
+    }));
+
+    results.push_back(measure("legalmoves_capture", runs, [&](const int reps)
+    {
+        Movelist moves;
+        int64_t calls = 0;
+        for (int r = 0; r < reps; ++r)
+        {
+            for (size_t i = 0; i < boards.size(); ++i)
+            {
+                if (legal[i].empty()) continue;
+
+                boards[i].makeMove(legal[i][0]);
+                movegen::legalmoves<movegen::MoveGenType::CAPTURE>(moves, boards[i]), sink += moves.size();
+                boards[i].unmakeMove(legal[i][0]);
+                ++calls;
+            }
+        }
+        return calls;
+    }));
+
+    results.push_back(measure("make_unmake", runs, [&](const int reps)
+    {
+        int64_t calls = 0;
+        for (int r = 0; r < reps; ++r)
+        {
+            for (size_t i = 0; i < boards.size(); ++i)
+            {
+                for (const Move& m : legal[i])
+                {
+                    boards[i].makeMove(m);
+                    sink += boards[i].hash();
+                    boards[i].unmakeMove(m);
+                }
+                calls += static_cast<int64_t>(legal[i].size());
+            }
+        }
+        return calls;
+    }));
+
+    results.push_back(measure("is_repetition", runs, [&](const int reps)
+    {
+        for (int r = 0; r < reps; ++r)
+            for (const Board& i : played) sink += i.isRepetition(1);
+        return int64_t(reps) * static_cast<int64_t>(boards.size());
+    }));
+
+    results.push_back(measure("is_insufficient_material", runs, [&](const int reps)
+    {
+        for (int r = 0; r < reps; ++r)
+            for (const Board& i : boards) sink += i.isInsufficientMaterial();
+        return int64_t(reps) * static_cast<int64_t>(boards.size());
+    }));
+
+    results.push_back(measure("uci_to_move", runs, [&](const int reps)
+    {
+        int64_t calls = 0;
+        for (int r = 0; r < reps; ++r)
+        {
+            for (size_t i = 0; i < boards.size(); ++i)
+            {
+                for (const std::string& m : uci_moves[i]) sink += uci::uciToMove(boards[i], m).move();
+                calls += static_cast<int64_t>(uci_moves[i].size());
+            }
+        }
+        return calls;
+    }));
+
+    results.push_back(measure("move_to_uci", runs, [&](const int reps)
+    {
+        int64_t calls = 0;
+        for (int r = 0; r < reps; ++r)
+        {
+            for (const std::vector<Move>& moves : legal)
+            {
+                for (const Move& m : moves) sink += uci::moveToUci(m).size();
+                calls += static_cast<int64_t>(moves.size());
+            }
+        }
+        return calls;
+    }));
+
+    results.push_back(measure("set_fen", runs, [&](const int reps)
+    {
+        Board board;
+        for (int r = 0; r < reps; ++r)
+            for (const char* fen : bench_positions) board.setFen(fen), sink += board.hash();
+        return int64_t(reps) * static_cast<int64_t>(boards.size());
+    }));
+
+    results.push_back(measure("compact_encode", runs, [&](const int reps)
+    {
+        for (int r = 0; r < reps; ++r)
+            for (const Board& i : boards) sink += Board::Compact::encode(i)[0];
+        return int64_t(reps) * static_cast<int64_t>(boards.size());
+    }));
+
+    results.push_back(measure("compact_decode", runs, [&](const int reps)
+    {
+        for (int r = 0; r < reps; ++r)
+            for (const PackedBoard& i : packed) sink += Board::Compact::decode(i).hash();
+        return int64_t(reps) * static_cast<int64_t>(packed.size());
+    }));
+
+    const auto percentile = [](const std::vector<double>& values, const int p) { return values[(values.size() - 1) * static_cast<size_t>(p) / 100]; };
+
+    std::ostringstream json;
+    json << std::fixed << std::setprecision(2) << "{\n  \"runs\": " << runs << ",\n  \"positions\": " << boards.size() << ",\n  \"benchmarks\": [\n";
+
+    for (size_t i = 0; i < results.size(); ++i)
+    {
+        const MicroResult& r = results[i];
+
+        std::cout << std::fixed << std::setprecision(2) << std::left << std::setw(26) << r.name
+                  << " median " << percentile(r.ns, 50) << " ns"
+                  << " p10 " << percentile(r.ns, 10)
+                  << " p90 " << percentile(r.ns, 90)
+                  << " min " << r.ns.front()
+                  << " max " << r.ns.back() << std::endl;
+
+        json << "    { \"name\": \"" << r.name << "\", \"calls_per_run\": " << r.calls
+             << ", \"median_ns\": " << percentile(r.ns, 50)
+             << ", \"p10_ns\": " << percentile(r.ns, 10)
+             << ", \"p90_ns\": " << percentile(r.ns, 90)
+             << ", \"min_ns\": " << r.ns.front()
+             << ", \"max_ns\": " << r.ns.back() << " }" << (i + 1 < results.size() ? "," : "") << "\n";
+    }
+
+    json << "  ],\n  \"checksum\": " << sink << "\n}\n";
+
+    std::ofstream out(file);
+    out << json.str();
+
+    if (out) std::cout << "info string wrote " << file << std::endl;
+    else std::cout << "info string could not write " << file << std::endl;
+}
+
+static constexpr int bench_depth = 10;
+
+// bench [depth] [threads]
+// Searches bench_positions to a fixed depth, each with a freshly cleared table of its thread, so the
+// total node count is a signature of the search that does not depend on the thread count
+static int64_t bench(const int depth, const int threads)
+{
+    constexpr size_t count = sizeof(bench_positions) / sizeof(bench_positions[0]);
+    std::vector<int64_t> node_counts(count, 0);
+    std::vector<Move> moves(count, Move::NO_MOVE);
+    std::atomic<size_t> next = 0;
+    std::vector<std::thread> workers;
+
+    SearchLimits limits;
+    limits.depth = depth;
+    stop_requested = false;
+
+    const std::chrono::time_point<std::chrono::steady_clock> start = std::chrono::steady_clock::now();
+
+    for (int t = 0; t < threads; ++t)
+    {
+        workers.emplace_back([&]()
+        {
+            TranspositionTable table;
+            table.resize(hash_mb);
+            search_tt = &table;
+
+            for (size_t i; (i = next.fetch_add(1)) < count;)
+            {
+                table.clear();
+                Board board(bench_positions[i]);
+                const SearchResult result = search(board, limits, false);
+                node_counts[i] = result.nodes;
+                moves[i] = result.move;
+            }
+
+            search_tt = &tt;
+        });
+    }
+
+    for (std::thread& i : workers) i.join();
+
+    const int64_t time = std::chrono::duration_cast<std::chrono::milliseconds>(std::chrono::steady_clock::now() - start).count();
+    int64_t total = 0;
+
+    for (size_t i = 0; i < count; ++i)
+    {
+        std::cout << "position " << i + 1 << "/" << count << " bestmove " << (moves[i] == Move::NO_MOVE ? "0000" : uci::moveToUci(moves[i])) << " nodes " << node_counts[i] << "\n";
+        total += node_counts[i];
+    }
+
+    // Multiply by 1000 to convert millisecond to second
+    std::cout << "\nTotal time (ms) : " << time
+              << "\nNodes searched  : " << total
+              << "\nNodes/second    : " << (time > 0 ? total * 1000 / time : 0)
+              << "\nSlider attacks  : " << attacks::sliderBackendName() << std::endl;
+
+    return total;
+}
+
+int main(int argc, char** argv)
+{
+    Board board = Board();
+    tt.resize(hash_mb);
+
+    // BlueWhale bench [depth] [threads] runs the bench and exits, for scripts and testing frameworks
+    if (argc > 1 && std::string(argv[1]) == "bench")
+    {
+        const int depth = argc > 2 ? std::atoi(argv[2]) : bench_depth;
+        const int threads = argc > 3 ? std::atoi(argv[3]) : 1;
+        bench(std::clamp(depth, 1, max_depth), std::max(1, threads));
+        return 0;
+    }
+
+    std::string input;
+
+    // go searches on its own thread so stop and isready are answered meanwhile
+    std::thread search_thread;
+
+    while (std::getline(std::cin, input))
+    {
+        std::istringstream iss(input);
+        std::string command;
+        iss >> command;
+
+        // Other commands wait for the search, stop and quit end it first
+        if (command != "isready" && search_thread.joinable())
+        {
+            if (command == "stop" || command == "quit") stop_requested = true;
+            search_thread.join();
+        }
+
+        if (command == "go")
+        {
+            // Book moves are played without searching
+            if (own_book && book.isOpen())
+            {
+                static std::mt19937_64 rng(std::random_device{}());
+                const Move book_move = book.pick(board, rng());
+
+                if (book_move != Move::NO_MOVE)
+                {
+                    std::cout << "bestmove " << uci::moveToUci(book_move) << std::endl;
+                    continue;
+                }
+            }
+
+            // go [wtime <x>] [btime <x>] [winc <x>] [binc <x>] [movestogo <x>] [movetime <x>] [depth <x>] [nodes <x>] [infinite]
+            std::string token;
+            SearchLimits limits;
+            int64_t time[2] = { 0, 0 };
+            int64_t inc[2] = { 0, 0 };
+            int64_t moves_to_go = 40;
+            int64_t move_time = 0;
+            bool infinite = false;
+
+            while (iss >> token)
+            {
+                if (token == "wtime") iss >> time[0];
+                else if (token == "btime") iss >> time[1];
+                else if (token == "winc") iss >> inc[0];
+                else if (token == "binc") iss >> inc[1];
+                else if (token == "movestogo") iss >> moves_to_go;
+                else if (token == "movetime") iss >> move_time;
+                else if (token == "depth") iss >> limits.depth;
+                else if (token == "nodes") iss >> limits.nodes;
+                else if (token == "infinite") infinite = true;
+            }
+
+            const int us = board.sideToMove() == Color::WHITE ? 0 : 1;
+            limits.depth = std::min(limits.depth, max_depth);
+
+            if (move_time > 0) limits.soft_time = limits.hard_time = std::max<int64_t>(1, move_time - move_overhead);
+
+            // Plan a share of the remaining time, an iteration may overrun it up to four times
+            else if (time[us] > 0)
+            {
+                const int64_t available = std::max<int64_t>(1, time[us] - move_overhead);
+                limits.soft_time = std::min(available, time[us] / std::max<int64_t>(1, moves_to_go) + inc[us] / 2);
+                limits.hard_time = std::min(available, limits.soft_time * 4);
+            }
+
+            tt.new_search();
+            stop_requested = false;
+
+            search_thread = std::thread([limits, infinite, search_board = board]() mutable
+            {
+                use_stored_results = true;
+                const SearchResult result = search(search_board, limits, true);
+                analysis_cache.flush();
+
+                // go infinite only answers after stop
+                while (infinite && !stop_requested) std::this_thread::sleep_for(std::chrono::milliseconds(1));
+
+                std::cout << "bestmove " << (result.move == Move::NO_MOVE ? "0000" : uci::moveToUci(result.move)) << std::endl;
+            });
+        }
+
+        else if (command == "position")
+        {
+            std::string subcommand;
+            std::string argument;
+            iss >> subcommand;
+
+            if (subcommand == "startpos")
+            {
+                board = Board();
+
+                // Remove "moves" from argument
+                iss >> argument;
+            }
+
+            else if (subcommand == "fen")
+            {
+                std::string fen;
+                while (iss >> argument && argument != "moves") fen += argument + " ";
+                board = Board(fen);
+            }
+
+            std::vector<std::string> moves;
+            while (iss >> argument) moves.push_back(argument);
+
+            for (const std::string& i : moves)
+            {
+                Move move = uci::uciToMove(board, i);
+                board.makeMove(move);
+            }
+        }
+
+        else if (command == "setoption")
+        {
+            // setoption name <id> value <x>
+            std::string token, name, value;
+            iss >> token;
+            while (iss >> token && token != "value") name += (name.empty() ? "" : " ") + token;
+            while (iss >> token) value += (value.empty() ? "" : " ") + token;
+
+            if (name == "Hash")
+            {
+                hash_mb = static_cast<size_t>(std::max(1, std::atoi(value.c_str())));
+                tt.resize(hash_mb);
+            }
+
+            else if (name == "OwnBook") own_book = value == "true";
+
+            else if (name == "BookFile")
+            {
+                if (value.empty() || value == "<empty>") book.close();
+                else if (!book.open(value)) std::cout << "info string could not open book " << value << std::endl;
+            }
+
+            // The size only applies when a new cache file is created
+            else if (name == "AnalysisCacheSize") analysis_cache_mb = static_cast<size_t>(std::max(1, std::atoi(value.c_str())));
+
+            else if (name == "AnalysisCacheDepth") cache_depth = std::clamp(std::atoi(value.c_str()), 1, max_depth);
+
+            else if (name == "AnalysisCache")
+            {
+                if (value.empty() || value == "<empty>") analysis_cache.close();
+                else if (!analysis_cache.open(value, analysis_cache_mb)) std::cout << "info string could not open analysis cache " << value << std::endl;
+            }
+
+            else if (name == "TablebasePath")
+            {
+                if (value.empty() || value == "<empty>") tablebases.close();
+                else std::cout << "info string found " << tablebases.open(value) << " tablebases in " << value << std::endl;
+            }
+
+            else if (name == "SliderAttacks")
+            {
+                const SliderBackend backend = value == "PEXT" ? SliderBackend::PEXT : value == "Magic" ? SliderBackend::MAGIC : SliderBackend::AUTO;
+                if (!attacks::setSliderBackend(backend)) std::cout << "info string PEXT is not supported on this CPU\n";
+                std::cout << "info string slider attacks use " << attacks::sliderBackendName() << std::endl;
+            }
+        }
+
+        else if (command == "datagen")
+        {
+            DatagenOptions options;
+            std::string token;
+            iss >> options.file;
+
+            while (iss >> token)
+            {
+                if (token == "games") iss >> options.games;
+                else if (token == "threads") iss >> options.threads;
+                else if (token == "nodes") iss >> options.nodes;
+                else if (token == "random") iss >> options.random_plies;
+                else if (token == "format" && iss >> token) options.format = token == "chain" ? TrainingFormat::CHAIN : TrainingFormat::PACKED;
+            }
+
+            if (options.file.empty()) std::cout << "info string usage: datagen <file> [games <n>] [threads <n>] [nodes <n>] [random <n>] [format packed|chain]" << std::endl;
+
+            else
+            {
+                options.threads = std::max(1, options.threads);
+                stop_requested = false;
+                datagen(options);
+            }
+        }
+
+        else if (command == "epdtest")
+        {
+            std::string file, token;
+            SearchLimits limits;
+            int threads = static_cast<int>(std::max(1u, std::thread::hardware_concurrency()));
+            iss >> file;
+
+            while (iss >> token)
+            {
+                if (token == "nodes") iss >> limits.nodes;
+                else if (token == "movetime" && iss >> limits.hard_time) limits.soft_time = limits.hard_time;
+                else if (token == "depth") iss >> limits.depth;
+                else if (token == "threads") iss >> threads;
+            }
+
+            // Node limited by default, a time limit does not repeat exactly
+            if (limits.nodes == INT64_MAX && limits.hard_time == INT64_MAX && limits.depth == max_depth) limits.nodes = 1000000;
+
+            limits.depth = std::min(limits.depth, max_depth);
+            stop_requested = false;
+
+            if (file.empty()) std::cout << "info string usage: epdtest <file> [nodes <n>] [movetime <ms>] [depth <n>] [threads <n>]" << std::endl;
+            else epdtest(file, limits, std::max(1, threads));
+        }
+
+        else if (command == "tbgen")
+        {
+            // tbgen <dir> [pieces <n>] [threads <n>] [<material>...]
+            std::string directory, token;
+            int pieces = 4;
+            int threads = static_cast<int>(std::max(1u, std::thread::hardware_concurrency()));
+            std::vector<tablebase::Material> materials;
+            iss >> directory;
+
+            while (iss >> token)
+            {
+                if (token == "pieces") iss >> pieces;
+                else if (token == "threads") iss >> threads;
+                else if (tablebase::Material::fromName(token).count() > 0) materials.push_back(tablebase::Material::fromName(token));
+                else std::cout << "info string unknown material " << token << std::endl;
+            }
+
+            if (directory.empty()) std::cout << "info string usage: tbgen <dir> [pieces <n>] [threads <n>] [<material>...]" << std::endl;
+
+            else
+            {
+                if (materials.empty()) materials = tablebase::allMaterials(std::clamp(pieces, 3, tablebase::max_men));
+
+                std::error_code error;
+                std::filesystem::create_directories(directory, error);
+
+                // Tables already on disk are reused, so an interrupted run can be restarted
+                tablebases.open(directory);
+                tablebase::Generator generator(tablebases, directory, threads);
+                generator.on_table = [](const std::string& name) { std::cout << "info string generating " << name << std::endl; };
+
+                const auto start = std::chrono::steady_clock::now();
+                bool ok = true;
+                for (const tablebase::Material& i : materials) ok = ok && generator.generate(i);
+
+                const int64_t seconds = std::chrono::duration_cast<std::chrono::seconds>(std::chrono::steady_clock::now() - start).count();
+                if (ok) std::cout << "info string generated tablebases in " << directory << " in " << seconds << " s" << std::endl;
+                else std::cout << "info string could not write tablebases to " << directory << std::endl;
+            }
+        }
+
+        else if (command == "quit") break;
+
+        else if (command == "uci")
+        {
+            std::cout << "id name BlueWhale-v1-10\n"
+                      << "id author StellarKitten\n"
+                      << "option name Hash type spin default 16 min 1 max 65536\n"
+                      << "option name SliderAttacks type combo default Auto var Auto var Magic var PEXT\n"
+                      << "option name OwnBook type check default false\n"
+                      << "option name BookFile type string default <empty>\n"
+                      << "option name TablebasePath type string default <empty>\n"
+                      << "option name AnalysisCache type string default <empty>\n"
+                      << "option name AnalysisCacheSize type spin default 256 min 1 max 65536\n"
+                      << "option name AnalysisCacheDepth type spin default 12 min 1 max 128\n"
+                      << "uciok" << std::endl;
+        }
+
+        else if (command == "bench")
+        {
+            // bench [depth] [threads], a missing value keeps its default
+            int depth = bench_depth;
+            int threads = 1;
+            if (!(iss >> depth)) depth = bench_depth;
+            else if (!(iss >> threads)) threads = 1;
+            bench(std::clamp(depth, 1, max_depth), std::max(1, threads));
+        }
+
+        else if (command == "microbench")
+        {
+            std::string token, file = "microbench.json";
+            int runs = 15;
+
+            while (iss >> token)
+            {
+                if (token == "runs") iss >> runs;
+                else if (token == "file") iss >> file;
+            }
+
+            microbench(std::max(1, runs), file);
+        }
+
+        else if (command == "stats")
+        {
+            // stats [reset], totals of all searches since the start or the last reset
+            std::string token;
+            iss >> token;
+
+            if (!stats_enabled) std::cout << "info string statistics are not compiled in, build with -DSTATS" << std::endl;
+
+            else
+            {
+                std::lock_guard<std::mutex> lock(stats_mutex);
+                if (token == "reset") total_stats = SearchStats();
+                else print_stats(total_stats);
+            }
+        }
+
+        else if (command == "savehash" || command == "loadhash")
+        {
+            std::string file;
+            iss >> file;
+
+            if (file.empty()) std::cout << "info string usage: " << command << " <file>" << std::endl;
+
+            else if (command == "savehash")
+            {
+                if (tt.save(file)) std::cout << "info string saved hash to " << file << std::endl;
+                else std::cout << "info string could not write " << file << std::endl;
+            }
+
+            else
+            {
+                size_t file_mb = 0;
+
+                if (tt.load(file, file_mb)) std::cout << "info string loaded " << file_mb << " MB hash from " << file << std::endl;
+                else if (file_mb != 0) std::cout << "info string " << file << " holds a " << file_mb << " MB hash, set Hash to " << file_mb << " first" << std::endl;
+                else std::cout << "info string could not load hash from " << file << std::endl;
+            }
+        }
+
+        else if (command == "ucinewgame")
+        {
+            board = Board();
+            tt.clear();
+        }
+
+        else if (command == "isready") std::cout << "readyok" << std::endl;
+    }
+
+    if (search_thread.joinable())
+    {
+        stop_requested = true;
+        search_thread.join();
     }
 }
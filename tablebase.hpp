@@ -0,0 +1,991 @@
+#ifndef TABLEBASE_HPP
+#define TABLEBASE_HPP
+
+#include <algorithm>
+#include <array>
+#include <atomic>
+#include <cstdint>
+#include <cstdlib>
+#include <cstring>
+#include <fstream>
+#include <memory>
+#include <string>
+#include <thread>
+#include <unordered_map>
+#include <vector>
+#include "chess.hpp"
+
+// Endgame tablebases generated on this machine by retrograde analysis
+//
+// A table holds one byte per position and side to move with the result and the distance in
+// plies to mate or to the next capture or promotion (DTC), both for the side to move, or two
+// bytes in a table with a distance beyond what one byte holds. The index
+// joins the two kings into one number, the white king folded into a1-d1-d4 (files a-d with pawns)
+// and the black king not touching it, which leaves 462 king pairs (1806 with pawns). Every group
+// of identical pieces adds the rank of its set of squares, C(64, k) values for k pieces, pawns
+// only use the 48 squares of ranks 2-7. Castling, en passant and the 50 move rule are not part
+// of the tables, positions with castling rights or an en passant square are not probed.
+namespace tablebase
+{
+    static constexpr int max_men = 5;
+
+    // Piece types as plain numbers, in the order of chess::PieceType
+    enum : int { PAWN, KNIGHT, BISHOP, ROOK, QUEEN, KING };
+
+    enum class Wdl { LOSS, DRAW, WIN };
+
+    struct ProbeResult
+    {
+        Wdl wdl;
+        int dtc;
+    };
+
+    // Stored values: 0 draw, 1-125 win in that many plies, loss_value + n loss in n plies with n up
+    // to 125; the generator caps distances at max_distance and keeps the exact ones beyond it apart
+    static constexpr uint8_t draw_value = 0;
+    static constexpr uint8_t loss_value = 128;
+    static constexpr uint8_t max_distance = 125;
+    static constexpr uint8_t unknown_value = 254;
+    static constexpr uint8_t invalid_value = 255;
+
+    inline bool isWin(const uint8_t value) { return value >= 1 && value < loss_value; }
+    inline bool isLoss(const uint8_t value) { return value >= loss_value && value < unknown_value; }
+
+    // Two byte values of tables with longer distances: 0 draw, n win in n plies, wide_loss_value + n loss in n plies
+    static constexpr uint16_t wide_loss_value = 0x8000;
+
+    // Pieces of a position, colours are 0 for white and 1 for black
+    struct Position
+    {
+        int count = 0;
+        std::array<int, max_men> color{};
+        std::array<int, max_men> type{};
+        std::array<int, max_men> square{};
+        int stm = 0;
+    };
+
+    using Counts = std::array<std::array<int, 6>, 2>;
+
+    // C(n, k) for the square sets of up to max_men identical pieces
+    inline uint64_t binomial(const int n, const int k)
+    {
+        static const auto table = []()
+        {
+            std::array<std::array<uint64_t, max_men + 1>, 65> table{};
+            for (int i = 0; i <= 64; ++i)
+            {
+                table[i][0] = 1;
+                for (int j = 1; j <= std::min(i, max_men); ++j) table[i][j] = table[i - 1][j - 1] + (j < i ? table[i - 1][j] : 0);
+            }
+            return table;
+        }();
+
+        return n < k ? 0 : table[n][k];
+    }
+
+    // Joint index of the two kings, -1 for pairs outside the folded region or touching kings;
+    // without pawns a white king on a1-d4 also puts the black king on or below that diagonal
+    struct KingPairs
+    {
+        std::array<std::array<int16_t, 64>, 64> index;
+        std::vector<std::array<int, 2>> squares;
+    };
+
+    inline const KingPairs& kingPairs(const bool pawns)
+    {
+        static const auto build = [](const bool pawns)
+        {
+            KingPairs pairs;
+
+            for (int wk = 0; wk < 64; ++wk)
+            {
+                for (int bk = 0; bk < 64; ++bk)
+                {
+                    const int wf = wk & 7, wr = wk >> 3, bf = bk & 7, br = bk >> 3;
+                    const bool touching = std::abs(wf - bf) <= 1 && std::abs(wr - br) <= 1;
+                    const bool folded = pawns ? wf < 4 : wf < 4 && wr <= wf && (wr != wf || br <= bf);
+
+                    pairs.index[wk][bk] = -1;
+                    if (touching || !folded) continue;
+
+                    pairs.index[wk][bk] = static_cast<int16_t>(pairs.squares.size());
+                    pairs.squares.push_back({ wk, bk });
+                }
+            }
+
+            return pairs;
+        };
+
+        static const KingPairs tables[2] = { build(false), build(true) };
+        return tables[pawns];
+    }
+
+    // Squares a piece of the type can stand on, pawns never stand on the first or last rank
+    inline int squareCount(const int type) { return type == PAWN ? 48 : 64; }
+    inline int squareOffset(const int type) { return type == PAWN ? 8 : 0; }
+
+    // Non-king pieces from the strongest, so material can be compared and named
+    inline std::vector<int> strongestFirst(const std::array<int, 6>& counts)
+    {
+        std::vector<int> types;
+        for (int pt = QUEEN; pt >= PAWN; --pt)
+            for (int i = 0; i < counts[pt]; ++i) types.push_back(pt);
+        return types;
+    }
+
+    // The side with more material is white in a table, true if counts have to be colour flipped
+    inline bool blackIsStronger(const Counts& counts)
+    {
+        const std::vector<int> white = strongestFirst(counts[0]);
+        const std::vector<int> black = strongestFirst(counts[1]);
+        return white.size() != black.size() ? black.size() > white.size() : black > white;
+    }
+
+    // Piece layout of a table: white king, black king, then the white and black pieces strongest first
+    class Material
+    {
+    public:
+        Material() = default;
+
+        // counts[color][piece type] without the kings, with the stronger side as white
+        explicit Material(const Counts& counts) : counts(counts)
+        {
+            colors = { 0, 1 };
+            types = { KING, KING };
+
+            for (int c = 0; c < 2; ++c)
+            {
+                for (const int pt : strongestFirst(counts[c]))
+                {
+                    colors.push_back(c);
+                    types.push_back(pt);
+                }
+            }
+        }
+
+        // From a name like KRPvKR, an empty material if it does not parse
+        static Material fromName(const std::string& name)
+        {
+            static const std::string letters = "PNBRQ";
+            Counts counts{};
+            int side = -1;
+
+            for (const char c : name)
+            {
+                if (c == 'K') ++side;
+                else if (c == 'v' && side == 0) continue;
+                else if (side < 0 || side > 1 || letters.find(c) == std::string::npos) return Material();
+                else ++counts[side][letters.find(c)];
+            }
+
+            const Material material(counts);
+            if (side != 1 || material.count() > max_men || blackIsStronger(counts) || material.name() != name) return Material();
+            return material;
+        }
+
+        std::string name() const
+        {
+            static const char letters[] = "PNBRQ";
+            std::string name;
+
+            for (int c = 0; c < 2; ++c)
+            {
+                name += c == 0 ? "K" : "vK";
+                for (const int pt : strongestFirst(counts[c])) name += letters[pt];
+            }
+
+            return name;
+        }
+
+        int count() const { return static_cast<int>(types.size()); }
+
+        bool hasPawns() const { return counts[0][PAWN] + counts[1][PAWN] > 0; }
+
+        bool same(const int a, const int b) const { return colors[a] == colors[b] && types[a] == types[b]; }
+
+        // Number of identical pieces from slot i on
+        int groupSize(const int i) const
+        {
+            int n = 1;
+            while (i + n < count() && same(i, i + n)) ++n;
+            return n;
+        }
+
+        // Positions per side to move
+        uint64_t size() const
+        {
+            uint64_t size = kingPairs(hasPawns()).squares.size();
+            for (int i = 2, n; i < count(); i += n)
+            {
+                n = groupSize(i);
+                size *= binomial(squareCount(types[i]), n);
+            }
+            return size;
+        }
+
+        static uint64_t key(const Counts& counts)
+        {
+            uint64_t key = 0;
+            for (int c = 0; c < 2; ++c)
+                for (int pt = 0; pt < 5; ++pt) key |= uint64_t(counts[c][pt]) << (4 * (c * 5 + pt));
+            return key;
+        }
+
+        uint64_t key() const { return key(counts); }
+
+        Counts counts{};
+        std::vector<int> colors;
+        std::vector<int> types;
+    };
+
+    // Every table of 3 up to men pieces
+    inline std::vector<Material> allMaterials(const int men)
+    {
+        std::vector<Material> materials;
+
+        // Multisets of non-king pieces as counts per type
+        std::vector<std::array<int, 6>> sets = { {} };
+        for (size_t i = 0; i < sets.size(); ++i)
+        {
+            int pieces = 0;
+            for (const int n : sets[i]) pieces += n;
+            if (pieces == men - 2) continue;
+
+            for (int pt = PAWN; pt <= QUEEN; ++pt)
+            {
+                // add types in descending order only, so each multiset is built once
+                bool lowest = true;
+                for (int j = 0; j < pt; ++j) lowest &= sets[i][j] == 0;
+                if (!lowest) continue;
+
+                std::array<int, 6> next = sets[i];
+                ++next[pt];
+                sets.push_back(next);
+            }
+        }
+
+        for (int total = 1; total <= men - 2; ++total)
+        {
+            for (const auto& white : sets)
+            {
+                for (const auto& black : sets)
+                {
+                    int pieces = 0;
+                    for (int pt = 0; pt < 6; ++pt) pieces += white[pt] + black[pt];
+
+                    const Counts counts = { white, black };
+                    if (pieces == total && !blackIsStronger(counts)) materials.emplace_back(counts);
+                }
+            }
+        }
+
+        return materials;
+    }
+
+    inline int transform(int sq, const int t)
+    {
+        if (t & 4) sq = ((sq >> 3) | (sq << 3)) & 63;
+        if (t & 1) sq ^= 7;
+        if (t & 2) sq ^= 56;
+        return sq;
+    }
+
+    // The smallest index over the symmetric copies of the position
+    inline uint64_t canonicalIndex(const Material& material, const int* squares)
+    {
+        const bool pawns = material.hasPawns();
+        const KingPairs& kings = kingPairs(pawns);
+        const int n = material.count();
+        uint64_t best = UINT64_MAX;
+        int s[max_men];
+
+        for (int t = 0; t < (pawns ? 2 : 8); ++t)
+        {
+            for (int i = 0; i < n; ++i) s[i] = transform(squares[i], t);
+
+            const int pair = kings.index[s[0]][s[1]];
+            if (pair < 0) continue;
+
+            uint64_t index = static_cast<uint64_t>(pair);
+
+            // A group of identical pieces is a set of squares, ranked as sorted squares c0 < c1 < ... by the sum of C(ci, i + 1)
+            for (int i = 2, k; i < n; i += k)
+            {
+                k = material.groupSize(i);
+                const int offset = squareOffset(material.types[i]);
+
+                std::sort(s + i, s + i + k);
+
+                uint64_t rank = 0;
+                for (int j = 0; j < k; ++j) rank += binomial(s[i + j] - offset, j + 1);
+
+                index = index * binomial(squareCount(material.types[i]), k) + rank;
+            }
+
+            best = std::min(best, index);
+        }
+
+        return best;
+    }
+
+    inline void decodeIndex(const Material& material, uint64_t index, int* squares)
+    {
+        int starts[max_men];
+        int groups = 0;
+
+        for (int i = 2; i < material.count(); i += material.groupSize(i)) starts[groups++] = i;
+
+        for (int g = groups - 1; g >= 0; --g)
+        {
+            const int i = starts[g];
+            const int k = material.groupSize(i);
+            const int count = squareCount(material.types[i]);
+            const uint64_t sets = binomial(count, k);
+
+            uint64_t rank = index % sets;
+            index /= sets;
+
+            // Undo the ranking from the highest square down
+            for (int j = k - 1, c = count - 1; j >= 0; --j)
+            {
+                while (binomial(c, j + 1) > rank) --c;
+                rank -= binomial(c, j + 1);
+                squares[i + j] = c + squareOffset(material.types[i]);
+                --c;
+            }
+        }
+
+        const std::array<int, 2>& kings = kingPairs(material.hasPawns()).squares[static_cast<size_t>(index)];
+        squares[0] = kings[0];
+        squares[1] = kings[1];
+    }
+
+    inline chess::Bitboard pieceAttacks(const int type, const int color, const int sq, const chess::Bitboard occupied)
+    {
+        const chess::Square square(sq);
+
+        switch (type)
+        {
+            case PAWN: return chess::attacks::pawn(chess::Color(color), square);
+            case KNIGHT: return chess::attacks::knight(square);
+            case BISHOP: return chess::attacks::bishop(square, occupied);
+            case ROOK: return chess::attacks::rook(square, occupied);
+            case QUEEN: return chess::attacks::queen(square, occupied);
+            default: return chess::attacks::king(square);
+        }
+    }
+
+    class Tablebases
+    {
+    public:
+        static constexpr uint32_t version = 3;
+
+        // "BWTB" | version 32 | size 64 | name 16 bytes | bytes per value 32 | padding
+        static constexpr size_t header_size = 48;
+
+        static std::string path(const std::string& directory, const Material& material) { return directory + "/" + material.name() + ".bwtb"; }
+
+        // Opens every table found in directory, returns how many
+        int open(const std::string& directory)
+        {
+            close();
+
+            int opened = 0;
+            for (const Material& i : allMaterials(max_men)) opened += add(directory, i);
+            return opened;
+        }
+
+        void close()
+        {
+            tables.clear();
+            men = 0;
+        }
+
+        // Opens one table after checking its header
+        bool add(const std::string& directory, const Material& material)
+        {
+            auto table = std::make_unique<Table>(path(directory, material));
+            const std::string_view data = table->file.data();
+
+            if (data.size() < header_size) return false;
+
+            char name[16] = {};
+            std::memcpy(name, data.data() + 16, sizeof(name));
+
+            uint32_t file_version = 0;
+            uint64_t size = 0;
+            uint32_t width = 0;
+            std::memcpy(&file_version, data.data() + 4, 4);
+            std::memcpy(&size, data.data() + 8, 8);
+            std::memcpy(&width, data.data() + 32, 4);
+
+            if (data.compare(0, 4, "BWTB") != 0 || file_version != version || size != material.size() || material.name() != name) return false;
+            if ((width != 1 && width != 2) || data.size() != header_size + 2 * width * size) return false;
+
+            table->material = material;
+            table->width = static_cast<int>(width);
+            table->values[0] = reinterpret_cast<const uint8_t*>(data.data()) + header_size;
+            table->values[1] = table->values[0] + width * size;
+
+            tables[material.key()] = std::move(table);
+            men = std::max(men, material.count());
+            return true;
+        }
+
+        bool has(const Material& material) const { return tables.count(material.key()) != 0; }
+
+        int maxMen() const { return men; }
+
+        // Stored value for the side to move with distances capped at max_distance, invalid_value if there is no table
+        uint8_t value(const Position& position) const
+        {
+            ProbeResult result;
+            if (!lookup(position, result)) return invalid_value;
+
+            const uint8_t distance = static_cast<uint8_t>(std::min(result.dtc, int(max_distance)));
+            return result.wdl == Wdl::WIN ? distance : result.wdl == Wdl::LOSS ? static_cast<uint8_t>(loss_value + distance) : draw_value;
+        }
+
+        // Result and exact distance for the side to move, false if there is no table
+        bool lookup(const Position& position, ProbeResult& result) const
+        {
+            Counts counts{};
+            for (int i = 0; i < position.count; ++i)
+                if (position.type[i] != KING) ++counts[position.color[i]][position.type[i]];
+
+            if (position.count == 2)
+            {
+                result = { Wdl::DRAW, 0 };
+                return true;
+            }
+
+            const int flip = blackIsStronger(counts) ? 1 : 0;
+            if (flip) std::swap(counts[0], counts[1]);
+
+            const auto it = tables.find(Material::key(counts));
+            if (it == tables.end()) return false;
+
+            const Table& table = *it->second;
+            const Material& material = table.material;
+
+            // Place the pieces into the table layout, colour flipped if black is the stronger side
+            int squares[max_men];
+            bool used[max_men] = {};
+
+            for (int slot = 0; slot < material.count(); ++slot)
+            {
+                for (int i = 0; i < position.count; ++i)
+                {
+                    if (!used[i] && (position.color[i] ^ flip) == material.colors[slot] && position.type[i] == material.types[slot])
+                    {
+                        used[i] = true;
+                        squares[slot] = flip ? position.square[i] ^ 56 : position.square[i];
+                        break;
+                    }
+                }
+            }
+
+            const uint64_t index = canonicalIndex(material, squares);
+            const uint8_t* values = table.values[position.stm ^ flip];
+
+            if (table.width == 2)
+            {
+                uint16_t value;
+                std::memcpy(&value, values + 2 * index, 2);
+
+                if (value >= wide_loss_value) result = { Wdl::LOSS, value - wide_loss_value };
+                else result = { value == draw_value ? Wdl::DRAW : Wdl::WIN, value };
+                return true;
+            }
+
+            const uint8_t value = values[index];
+
+            if (isWin(value)) result = { Wdl::WIN, value };
+            else if (isLoss(value)) result = { Wdl::LOSS, value - loss_value };
+            else result = { Wdl::DRAW, 0 };
+
+            return true;
+        }
+
+        bool probe(const chess::Board& board, ProbeResult& result) const
+        {
+            chess::Bitboard occupied = board.occ();
+
+            if (occupied.count() > men || !board.castlingRights().isEmpty() || board.enpassantSq() != chess::Square::underlying::NO_SQ) return false;
+
+            Position position;
+            position.stm = board.sideToMove() == chess::Color::WHITE ? 0 : 1;
+
+            while (occupied)
+            {
+                const int sq = occupied.pop();
+                const chess::Piece piece = board.at(chess::Square(sq));
+                position.color[position.count] = piece.color() == chess::Color::WHITE ? 0 : 1;
+                position.type[position.count] = static_cast<int>(piece.type());
+                position.square[position.count] = sq;
+                ++position.count;
+            }
+
+            return lookup(position, result);
+        }
+
+    private:
+        struct Table
+        {
+            explicit Table(const std::string& path) : file(path, false) {}
+
+            chess::detail::MappedFile file;
+            Material material;
+            int width = 1;
+            const uint8_t* values[2] = { nullptr, nullptr };
+        };
+
+        std::unordered_map<uint64_t, std::unique_ptr<Table>> tables;
+        int men = 0;
+    };
+
+    // Builds tables by retrograde analysis after the tables its captures and promotions lead to
+    class Generator
+    {
+    public:
+        Generator(Tablebases& tablebases, const std::string& directory, const int threads)
+            : tablebases(tablebases), directory(directory), threads(std::max(1, threads)) {}
+
+        // Generates the table unless it is already open, false if a file could not be written
+        bool generate(const Material& material)
+        {
+            if (material.count() <= 2 || tablebases.has(material) || tablebases.add(directory, material)) return true;
+
+            for (const Material& i : successors(material))
+                if (!generate(i)) return false;
+
+            return build(material);
+        }
+
+        // Called with the name of every table before it is built
+        void (*on_table)(const std::string& name) = nullptr;
+
+    private:
+        // Tables a capture or a promotion leads to
+        static std::vector<Material> successors(const Material& material)
+        {
+            std::vector<Material> result;
+
+            const auto push = [&](Counts counts)
+            {
+                if (blackIsStronger(counts)) std::swap(counts[0], counts[1]);
+                result.emplace_back(counts);
+            };
+
+            for (int c = 0; c < 2; ++c)
+            {
+                for (int pt = PAWN; pt <= QUEEN; ++pt)
+                {
+                    if (material.counts[c][pt] == 0) continue;
+
+                    Counts captured = material.counts;
+                    --captured[c][pt];
+                    push(captured);
+
+                    if (pt != PAWN) continue;
+
+                    // Promotions, also together with a capture
+                    for (int promotion = KNIGHT; promotion <= QUEEN; ++promotion)
+                    {
+                        Counts promoted = material.counts;
+                        --promoted[c][pt];
+                        ++promoted[c][promotion];
+                        push(promoted);
+
+                        for (int victim = KNIGHT; victim <= QUEEN; ++victim)
+                        {
+                            if (promoted[c ^ 1][victim] == 0) continue;
+
+                            Counts both = promoted;
+                            --both[c ^ 1][victim];
+                            push(both);
+                        }
+                    }
+                }
+            }
+
+            return result;
+        }
+
+        struct Work
+        {
+            const Material& material;
+            uint64_t size;
+            std::unique_ptr<std::atomic<uint8_t>[]> values[2];
+            std::unique_ptr<std::atomic<uint8_t>[]> counters[2];
+
+            // Exact distances of the positions stored as max_distance, by side to move
+            std::vector<std::pair<uint64_t, uint16_t>> beyond[2];
+        };
+
+        static bool attacked(const Position& p, const int target, const int by, const chess::Bitboard occupied, const int skip)
+        {
+            for (int i = 0; i < p.count; ++i)
+                if (i != skip && p.color[i] == by && (pieceAttacks(p.type[i], p.color[i], p.square[i], occupied) & chess::Bitboard::fromSquare(target))) return true;
+
+            return false;
+        }
+
+        static Position decode(const Material& material, const uint64_t index, const int stm)
+        {
+            Position p;
+            p.count = material.count();
+            p.stm = stm;
+            decodeIndex(material, index, p.square.data());
+
+            for (int i = 0; i < p.count; ++i)
+            {
+                p.color[i] = material.colors[i];
+                p.type[i] = material.types[i];
+            }
+
+            return p;
+        }
+
+        // Sets the value of a position from its moves, distances 0 and 1 go to the first frontiers
+        void initialize(Work& work, const uint64_t index, const int stm, std::vector<uint64_t> frontier[2]) const
+        {
+            const Material& material = work.material;
+            const Position p = decode(material, index, stm);
+            std::atomic<uint8_t>& value = work.values[stm][index];
+
+            chess::Bitboard occupied, own;
+            for (int i = 0; i < p.count; ++i)
+            {
+                occupied |= chess::Bitboard::fromSquare(p.square[i]);
+                if (p.color[i] == stm) own |= chess::Bitboard::fromSquare(p.square[i]);
+            }
+
+            // Pieces of different groups may share a square, and a symmetric copy may have the smaller index
+            const bool valid = occupied.count() == p.count && canonicalIndex(material, p.square.data()) == index;
+
+            // The side not to move must not be in check
+            if (!valid || attacked(p, p.square[stm ^ 1], stm, occupied, -1))
+            {
+                value.store(invalid_value, std::memory_order_relaxed);
+                return;
+            }
+
+            int legal = 0;
+            bool draw_exit = false;
+            std::vector<uint64_t> children;
+
+            for (int i = 0; i < p.count; ++i)
+            {
+                if (p.color[i] != stm) continue;
+
+                const int from = p.square[i];
+                chess::Bitboard targets;
+
+                if (p.type[i] == PAWN)
+                {
+                    const int up = stm == 0 ? 8 : -8;
+                    targets = pieceAttacks(PAWN, stm, from, occupied) & (occupied & ~own);
+
+                    if (!(occupied & chess::Bitboard::fromSquare(from + up)))
+                    {
+                        targets |= chess::Bitboard::fromSquare(from + up);
+                        const bool start = stm == 0 ? from < 16 : from >= 48;
+                        if (start && !(occupied & chess::Bitboard::fromSquare(from + 2 * up))) targets |= chess::Bitboard::fromSquare(from + 2 * up);
+                    }
+                }
+                else targets = pieceAttacks(p.type[i], stm, from, occupied) & ~own;
+
+                while (targets)
+                {
+                    const int to = targets.pop();
+
+                    int captured = -1;
+                    for (int j = 0; j < p.count; ++j)
+                        if (p.square[j] == to) captured = j;
+
+                    const bool promotes = p.type[i] == PAWN && (to < 8 || to >= 56);
+                    const chess::Bitboard after = (occupied & ~chess::Bitboard::fromSquare(from)) | chess::Bitboard::fromSquare(to);
+                    Position child = p;
+                    child.square[i] = to;
+
+                    if (attacked(child, child.square[stm], stm ^ 1, after, captured)) continue;
+
+                    ++legal;
+
+                    // Captures and promotions leave the table, their value comes from another one
+                    if (captured >= 0 || promotes)
+                    {
+                        Position exit = child;
+                        exit.stm ^= 1;
+                        int moved = i;
+
+                        if (captured >= 0)
+                        {
+                            const int last = exit.count - 1;
+                            exit.color[captured] = exit.color[last];
+                            exit.type[captured] = exit.type[last];
+                            exit.square[captured] = exit.square[last];
+                            if (moved == last) moved = captured;
+                            --exit.count;
+                        }
+
+                        const int first = promotes ? KNIGHT : exit.type[moved];
+                        const int last = promotes ? QUEEN : exit.type[moved];
+
+                        for (int promotion = first; promotion <= last; ++promotion)
+                        {
+                            exit.type[moved] = promotion;
+                            const uint8_t v = tablebases.value(exit);
+
+                            if (isLoss(v))
+                            {
+                                value.store(1, std::memory_order_relaxed);
+                                frontier[1].push_back(index << 1 | static_cast<uint64_t>(stm));
+                                return;
+                            }
+
+                            if (v == draw_value) draw_exit = true;
+                        }
+                    }
+
+                    else children.push_back(canonicalIndex(material, child.square.data()));
+                }
+            }
+
+            if (legal == 0)
+            {
+                const bool check = attacked(p, p.square[stm], stm ^ 1, occupied, -1);
+                value.store(check ? loss_value : draw_value, std::memory_order_relaxed);
+                if (check) frontier[0].push_back(index << 1 | static_cast<uint64_t>(stm));
+                return;
+            }
+
+            // A move into a position counts once even if several moves reach it
+            std::sort(children.begin(), children.end());
+            children.erase(std::unique(children.begin(), children.end()), children.end());
+
+            // A drawing exit is never refuted, so it keeps the counter above zero
+            const size_t open = children.size() + draw_exit;
+
+            if (open == 0)
+            {
+                value.store(loss_value + 1, std::memory_order_relaxed);
+                frontier[1].push_back(index << 1 | static_cast<uint64_t>(stm));
+                return;
+            }
+
+            work.counters[stm][index].store(static_cast<uint8_t>(open), std::memory_order_relaxed);
+            value.store(unknown_value, std::memory_order_relaxed);
+        }
+
+        // Positions of the side that just moved that lead to the given one, each once
+        static void predecessors(const Work& work, const uint64_t index, const int stm, std::vector<uint64_t>& result)
+        {
+            const Material& material = work.material;
+            const Position p = decode(material, index, stm);
+            const int mover = stm ^ 1;
+
+            chess::Bitboard occupied;
+            for (int i = 0; i < p.count; ++i) occupied |= chess::Bitboard::fromSquare(p.square[i]);
+
+            result.clear();
+
+            for (int i = 0; i < p.count; ++i)
+            {
+                if (p.color[i] != mover) continue;
+
+                const int sq = p.square[i];
+                chess::Bitboard origins;
+
+                if (p.type[i] == PAWN)
+                {
+                    const int down = mover == 0 ? -8 : 8;
+                    const int rank = mover == 0 ? sq >> 3 : 7 - (sq >> 3);
+
+                    if (rank >= 2 && !(occupied & chess::Bitboard::fromSquare(sq + down)))
+                    {
+                        origins |= chess::Bitboard::fromSquare(sq + down);
+                        if (rank == 3 && !(occupied & chess::Bitboard::fromSquare(sq + 2 * down))) origins |= chess::Bitboard::fromSquare(sq + 2 * down);
+                    }
+                }
+                else origins = pieceAttacks(p.type[i], mover, sq, occupied) & ~occupied;
+
+                while (origins)
+                {
+                    Position q = p;
+                    q.square[i] = origins.pop();
+
+                    const uint64_t q_index = canonicalIndex(material, q.square.data());
+                    if (work.values[mover][q_index].load(std::memory_order_relaxed) != invalid_value) result.push_back(q_index);
+                }
+            }
+
+            std::sort(result.begin(), result.end());
+            result.erase(std::unique(result.begin(), result.end()), result.end());
+        }
+
+        // Runs fn(begin, end, thread) over [0, size) in chunks on all threads
+        template <typename F>
+        void parallel(const uint64_t size, F fn) const
+        {
+            std::atomic<uint64_t> next = 0;
+            const uint64_t chunk = 4096;
+            std::vector<std::thread> workers;
+
+            for (int t = 0; t < threads; ++t)
+            {
+                workers.emplace_back([&, t]()
+                {
+                    for (uint64_t begin; (begin = next.fetch_add(chunk)) < size;) fn(begin, std::min(size, begin + chunk), t);
+                });
+            }
+
+            for (std::thread& i : workers) i.join();
+        }
+
+        bool build(const Material& material)
+        {
+            if (on_table) on_table(material.name());
+
+            Work work = { material, material.size(), {}, {}, {} };
+
+            for (int stm = 0; stm < 2; ++stm)
+            {
+                work.values[stm] = std::make_unique<std::atomic<uint8_t>[]>(work.size);
+                work.counters[stm] = std::make_unique<std::atomic<uint8_t>[]>(work.size);
+            }
+
+            // Per thread frontiers for distances 0 and 1, merged afterwards
+            std::vector<std::array<std::vector<uint64_t>, 2>> found(static_cast<size_t>(threads));
+
+            parallel(2 * work.size, [&](const uint64_t begin, const uint64_t end, const int t)
+            {
+                for (uint64_t i = begin; i < end; ++i) initialize(work, i >> 1, static_cast<int>(i & 1), found[static_cast<size_t>(t)].data());
+            });
+
+            std::vector<std::vector<uint64_t>> levels(2);
+            for (auto& i : found)
+                for (int d = 0; d < 2; ++d) levels[static_cast<size_t>(d)].insert(levels[static_cast<size_t>(d)].end(), i[static_cast<size_t>(d)].begin(), i[static_cast<size_t>(d)].end());
+
+            // Level n holds the positions decided at distance n, their predecessors are decided at n + 1
+            for (size_t n = 0; n < levels.size(); ++n)
+            {
+                const std::vector<uint64_t>& level = levels[n];
+                const uint8_t distance = static_cast<uint8_t>(std::min<size_t>(n + 1, max_distance));
+                std::vector<std::vector<uint64_t>> next(static_cast<size_t>(threads));
+
+                parallel(level.size(), [&](const uint64_t begin, const uint64_t end, const int t)
+                {
+                    std::vector<uint64_t> previous;
+
+                    for (uint64_t k = begin; k < end; ++k)
+                    {
+                        const uint64_t index = level[k] >> 1;
+                        const int stm = static_cast<int>(level[k] & 1);
+                        const bool lost = isLoss(work.values[stm][index].load(std::memory_order_relaxed));
+                        const int mover = stm ^ 1;
+
+                        predecessors(work, index, stm, previous);
+
+                        for (const uint64_t q : previous)
+                        {
+                            std::atomic<uint8_t>& value = work.values[mover][q];
+                            uint8_t expected = unknown_value;
+
+                            // Moving into a lost position wins, a position loses once every move is refuted
+                            if (lost)
+                            {
+                                if (value.compare_exchange_strong(expected, distance)) next[static_cast<size_t>(t)].push_back(q << 1 | static_cast<uint64_t>(mover));
+                            }
+
+                            else if (value.load(std::memory_order_relaxed) == unknown_value && work.counters[mover][q].fetch_sub(1) == 1)
+                            {
+                                if (value.compare_exchange_strong(expected, static_cast<uint8_t>(loss_value + distance))) next[static_cast<size_t>(t)].push_back(q << 1 | static_cast<uint64_t>(mover));
+                            }
+                        }
+                    }
+                });
+
+                std::vector<uint64_t> merged;
+                for (const auto& i : next) merged.insert(merged.end(), i.begin(), i.end());
+
+                if (!merged.empty())
+                {
+                    if (n + 1 > max_distance)
+                        for (const uint64_t i : merged) work.beyond[i & 1].emplace_back(i >> 1, static_cast<uint16_t>(n + 1));
+
+                    if (levels.size() <= n + 1) levels.emplace_back();
+                    levels[n + 1].insert(levels[n + 1].end(), merged.begin(), merged.end());
+                }
+
+                levels[n] = std::vector<uint64_t>();
+            }
+
+            return write(work) && tablebases.add(directory, material);
+        }
+
+        // Positions still unknown can avoid losing forever and are draws, a table with distances
+        // beyond max_distance is written with two bytes per value
+        bool write(Work& work) const
+        {
+            std::ofstream out(Tablebases::path(directory, work.material), std::ios::binary);
+
+            const uint32_t width = work.beyond[0].empty() && work.beyond[1].empty() ? 1 : 2;
+
+            char header[Tablebases::header_size] = {};
+            const std::string name = work.material.name();
+            const uint32_t version = Tablebases::version;
+            std::memcpy(header, "BWTB", 4);
+            std::memcpy(header + 4, &version, 4);
+            std::memcpy(header + 8, &work.size, 8);
+            std::memcpy(header + 16, name.data(), std::min<size_t>(name.size(), 15));
+            std::memcpy(header + 32, &width, 4);
+            out.write(header, sizeof(header));
+
+            std::vector<char> buffer;
+
+            for (int stm = 0; stm < 2; ++stm)
+            {
+                std::vector<std::pair<uint64_t, uint16_t>>& beyond = work.beyond[stm];
+                std::sort(beyond.begin(), beyond.end());
+                size_t next = 0;
+
+                for (uint64_t begin = 0; begin < work.size; begin += 1 << 20)
+                {
+                    const uint64_t end = std::min<uint64_t>(work.size, begin + (1 << 20));
+                    buffer.resize(static_cast<size_t>(end - begin) * width);
+
+                    for (uint64_t i = begin; i < end; ++i)
+                    {
+                        const uint8_t v = work.values[stm][i].load(std::memory_order_relaxed);
+                        char* to = &buffer[static_cast<size_t>(i - begin) * width];
+
+                        if (width == 1)
+                        {
+                            *to = static_cast<char>(v == unknown_value ? draw_value : v);
+                            continue;
+                        }
+
+                        int distance = isWin(v) ? v : isLoss(v) ? v - loss_value : 0;
+                        if (next < beyond.size() && beyond[next].first == i) distance = beyond[next++].second;
+
+                        const uint16_t wide = static_cast<uint16_t>(isLoss(v) ? wide_loss_value + distance : distance);
+                        std::memcpy(to, &wide, 2);
+                    }
+
+                    out.write(buffer.data(), static_cast<std::streamsize>(buffer.size()));
+                }
+            }
+
+            out.close();
+            return static_cast<bool>(out);
+        }
+
+        Tablebases& tablebases;
+        std::string directory;
+        int threads;
+    };
+}
+
+#endif
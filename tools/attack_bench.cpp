@@ -0,0 +1,115 @@
+// AttackBoard benchmark: incremental attack maps against recomputation.
+//
+//   g++ -std=c++17 -O2 -march=native tools/attack_bench.cpp -o attack_bench
+//   ./attack_bench [depth]
+//
+// Walks perft trees and queries, at every node, the squares each color attacks
+// and the number of attackers on every occupied square, the queries mobility,
+// king safety and hanging piece terms make. The incremental run reads them
+// from an AttackBoard, the recomputing run builds them from attacks:: lookups
+// on a plain Board. Both must give the same checksum, which also verifies the
+// incremental maps through castling, promotions and en passant.
+#include <chrono>
+#include <cstdlib>
+#include <iostream>
+#include "../chess.hpp"
+
+using namespace chess;
+
+static const char* const positions[] =
+{
+    "rnbqkbnr/pppppppp/8/8/8/8/PPPPPPPP/RNBQKBNR w KQkq - 0 1",
+    "r3k2r/p1ppqpb1/bn2pnp1/3PN3/1p2P3/2N2Q1p/PPPBBPPP/R3K2R w KQkq - 0 1",
+    "8/2p5/3p4/KP5r/1R3p1k/8/4P1P1/8 w - - 0 1",
+    "rnbq1k1r/pp1Pbppp/2p5/8/2B5/8/PPP1NnPP/RNBQK2R w KQ - 1 8"
+};
+
+static uint64_t queryIncremental(const AttackBoard& board)
+{
+    uint64_t sum = 0;
+
+    for (const Color color : { Color::WHITE, Color::BLACK })
+    {
+        sum += static_cast<uint64_t>(board.attacked(color).count());
+        for (auto occupied = board.occ(); occupied;) sum += static_cast<uint64_t>(board.attackCount(color, Square(occupied.pop())));
+    }
+
+    return sum;
+}
+
+static uint64_t queryRecompute(const Board& board)
+{
+    uint64_t sum = 0;
+
+    for (const Color color : { Color::WHITE, Color::BLACK })
+    {
+        Bitboard attacked;
+
+        for (auto pieces = board.us(color); pieces;)
+        {
+            const Square sq(pieces.pop());
+            const Piece piece = board.at(sq);
+
+            switch (piece.type().internal())
+            {
+                case PieceType::PAWN: attacked |= attacks::pawn(color, sq); break;
+                case PieceType::KNIGHT: attacked |= attacks::knight(sq); break;
+                case PieceType::BISHOP: attacked |= attacks::bishop(sq, board.occ()); break;
+                case PieceType::ROOK: attacked |= attacks::rook(sq, board.occ()); break;
+                case PieceType::QUEEN: attacked |= attacks::queen(sq, board.occ()); break;
+                default: attacked |= attacks::king(sq); break;
+            }
+        }
+
+        sum += static_cast<uint64_t>(attacked.count());
+        for (auto occupied = board.occ(); occupied;) sum += static_cast<uint64_t>(attacks::attackers(board, color, Square(occupied.pop())).count());
+    }
+
+    return sum;
+}
+
+template <typename B, typename Query>
+static uint64_t perft(B& board, const int depth, Query&& query)
+{
+    uint64_t sum = query(board);
+    if (depth == 0) return sum;
+
+    Movelist moves;
+    movegen::legalmoves(moves, board);
+
+    for (const Move& move : moves)
+    {
+        board.makeMove(move);
+        sum += perft(board, depth - 1, query);
+        board.unmakeMove(move);
+    }
+
+    return sum;
+}
+
+int main(int argc, char** argv)
+{
+    const int depth = argc > 1 ? std::atoi(argv[1]) : 4;
+    bool ok = true;
+
+    for (const char* fen : positions)
+    {
+        AttackBoard incremental(fen);
+        Board plain(fen);
+
+        auto start = std::chrono::steady_clock::now();
+        const uint64_t a = perft(incremental, depth, queryIncremental);
+        const auto incremental_ms = std::chrono::duration_cast<std::chrono::milliseconds>(std::chrono::steady_clock::now() - start).count();
+
+        start = std::chrono::steady_clock::now();
+        const uint64_t b = perft(plain, depth, queryRecompute);
+        const auto recompute_ms = std::chrono::duration_cast<std::chrono::milliseconds>(std::chrono::steady_clock::now() - start).count();
+
+        std::cout << fen << "\n  incremental " << incremental_ms << " ms, recompute " << recompute_ms << " ms"
+                  << (a == b ? "" : ", checksums differ") << "\n";
+
+        ok = ok && a == b;
+    }
+
+    return ok ? 0 : 1;
+}
@@ -0,0 +1,384 @@
+// Builds a Polyglot opening book from PGN files.
+//
+//   g++ -std=c++17 -O2 -march=native -pthread tools/book_builder.cpp -o book_builder
+//   ./book_builder book.bin games1.pgn games2.pgn [--ply 24] [--min-games 3] [--threads 8] [--memory 2048]
+//
+// Games are replayed with pgn::ParallelStreamParser and uci::parseSan(). Every
+// (position, move) pair within the first --ply plies is counted together with
+// the game result, from the point of view of the side that played the move, in
+// a hash map split into shards so the parser threads rarely contend. When the
+// map outgrows --memory MB it is sorted and spilled to a run file on disk, and
+// all runs are k-way merged at the end, so corpora larger than RAM still build.
+// The book weight of a move is 2 * wins + draws, scaled per position to 16 bits.
+#include <algorithm>
+#include <array>
+#include <atomic>
+#include <cstdio>
+#include <cstdlib>
+#include <fstream>
+#include <iostream>
+#include <mutex>
+#include <queue>
+#include <string>
+#include <unordered_map>
+#include <vector>
+#include "../chess.hpp"
+
+using namespace chess;
+
+struct Stats
+{
+    uint32_t wins = 0;
+    uint32_t draws = 0;
+    uint32_t games = 0;
+};
+
+// One aggregated (position, move) pair, also the record format of the run files
+struct Record
+{
+    uint64_t key;
+    uint16_t move;
+    Stats stats;
+
+    bool operator<(const Record& other) const { return key != other.key ? key < other.key : move < other.move; }
+};
+
+struct Options
+{
+    std::string output;
+    std::vector<std::string> inputs;
+    int ply = 24;
+    uint32_t min_games = 1;
+    unsigned threads = 0;
+    size_t memory_mb = 1024;
+};
+
+// Hash map split into shards with their own locks, spilled to sorted run files when full
+class ShardedMap
+{
+public:
+    ShardedMap(const std::string& run_prefix, const size_t memory_mb)
+        : run_prefix(run_prefix), capacity(std::max<size_t>(1, memory_mb * 1024 * 1024 / bytes_per_entry)) {}
+
+    void add(const std::vector<Record>& records)
+    {
+        for (const Record& r : records)
+        {
+            Shard& shard = shards[shardOf(r.key)];
+            std::lock_guard<std::mutex> lock(shard.mutex);
+
+            Stats& s = shard.map[Key{ r.key, r.move }];
+            const bool inserted = s.games == 0;
+            s.wins += r.stats.wins;
+            s.draws += r.stats.draws;
+            s.games += r.stats.games;
+
+            if (inserted) ++size;
+        }
+
+        if (size >= capacity) spill(capacity);
+    }
+
+    // Writes the map as a sorted run and empties it, if it holds at least minimum entries
+    void spill(const size_t minimum = 1)
+    {
+        std::array<std::unique_lock<std::mutex>, shard_count> locks;
+        for (size_t i = 0; i < shard_count; ++i) locks[i] = std::unique_lock<std::mutex>(shards[i].mutex);
+
+        // another thread may have spilled while this one waited for the locks
+        if (size < minimum) return;
+
+        std::vector<Record> records;
+        records.reserve(size);
+
+        for (Shard& shard : shards)
+        {
+            for (const auto& [k, s] : shard.map) records.push_back({ k.key, k.move, s });
+            shard.map.clear();
+        }
+
+        std::sort(records.begin(), records.end());
+
+        const std::string path = run_prefix + std::to_string(runs.size());
+        std::ofstream out(path, std::ios::binary);
+        out.write(reinterpret_cast<const char*>(records.data()), static_cast<std::streamsize>(records.size() * sizeof(Record)));
+
+        if (!out)
+        {
+            std::cerr << "cannot write run file " << path << "\n";
+            std::exit(1);
+        }
+
+        runs.push_back(path);
+        size = 0;
+    }
+
+    const std::vector<std::string>& runFiles() const { return runs; }
+
+private:
+    struct Key
+    {
+        uint64_t key;
+        uint16_t move;
+
+        bool operator==(const Key& other) const { return key == other.key && move == other.move; }
+    };
+
+    struct KeyHash
+    {
+        size_t operator()(const Key& k) const { return static_cast<size_t>(k.key ^ (uint64_t(k.move) * 0x9E3779B97F4A7C15ull)); }
+    };
+
+    struct Shard
+    {
+        std::mutex mutex;
+        std::unordered_map<Key, Stats, KeyHash> map;
+    };
+
+    static constexpr size_t shard_count = 64;
+
+    // rough cost of one unordered_map node plus its bucket
+    static constexpr size_t bytes_per_entry = 64;
+
+    // the high key bits pick the shard, so the maps still see well mixed low bits
+    static size_t shardOf(const uint64_t key) { return (key >> 32) & (shard_count - 1); }
+
+    std::array<Shard, shard_count> shards;
+    std::atomic<size_t> size = 0;
+    std::string run_prefix;
+    size_t capacity;
+    std::vector<std::string> runs;
+};
+
+// Replays one chunk of games and feeds the opening positions into the map
+class BookVisitor : public pgn::Visitor
+{
+public:
+    // a pointer because readGames() hands the same const arguments to every visitor
+    BookVisitor(ShardedMap* map, const int max_ply) : map(map), max_ply(max_ply) {}
+
+    ~BookVisitor() override { map->add(pending); }
+
+    void startPgn() override
+    {
+        board.setFen(constants::STARTPOS);
+        result = 0;
+        ply = 0;
+        game.clear();
+    }
+
+    void header(std::string_view key, std::string_view value) override
+    {
+        if (key == "FEN") board.setFen(value);
+
+        // from white's point of view, 0 also for unfinished games which are skipped
+        if (key == "Result") result = value == "1-0" ? 1 : value == "0-1" ? -1 : value == "1/2-1/2" ? 2 : 0;
+    }
+
+    void startMoves() override
+    {
+        if (result == 0) skipPgn(true);
+    }
+
+    void move(std::string_view san, std::string_view) override
+    {
+        if (ply >= max_ply || san.empty()) return;
+
+        Move move;
+
+        try
+        {
+            move = uci::parseSan(board, san, scratch);
+        }
+        catch (const std::exception&)
+        {
+            // drop the rest of a game that does not replay
+            ply = max_ply;
+            return;
+        }
+
+        const bool white = board.sideToMove() == Color::WHITE;
+        const Stats stats = { result == (white ? 1 : -1) ? 1u : 0u, result == 2 ? 1u : 0u, 1u };
+        const Record record = { polyglot::key(board), polyglot::encode(move), stats };
+
+        // a transposition or repetition within the game counts the pair once
+        if (std::none_of(game.begin(), game.end(), [&](const Record& r) { return r.key == record.key && r.move == record.move; })) game.push_back(record);
+
+        board.makeMove(move);
+        ++ply;
+    }
+
+    void endPgn() override
+    {
+        pending.insert(pending.end(), game.begin(), game.end());
+        game.clear();
+
+        if (pending.size() >= 4096)
+        {
+            map->add(pending);
+            pending.clear();
+        }
+    }
+
+private:
+    ShardedMap* map;
+    const int max_ply;
+
+    Board board;
+    Movelist scratch;
+    int result = 0;
+    int ply = 0;
+
+    std::vector<Record> game;
+    std::vector<Record> pending;
+};
+
+// Sequential reader over one sorted run file
+class RunReader
+{
+public:
+    explicit RunReader(const std::string& path) : in(path, std::ios::binary) { next(); }
+
+    bool next()
+    {
+        in.read(reinterpret_cast<char*>(&current), sizeof(Record));
+        return valid = static_cast<bool>(in);
+    }
+
+    Record current{};
+    bool valid = false;
+
+private:
+    std::ifstream in;
+};
+
+static void writeBig(std::ostream& out, const uint64_t value, const int bytes)
+{
+    for (int i = bytes - 1; i >= 0; --i) out.put(static_cast<char>(value >> (8 * i)));
+}
+
+// Turns the moves of one position into book entries
+static void writePosition(std::ostream& out, std::vector<Record>& moves, const uint32_t min_games, uint64_t& written)
+{
+    moves.erase(std::remove_if(moves.begin(), moves.end(), [&](const Record& r) { return r.stats.games < min_games || 2 * r.stats.wins + r.stats.draws == 0; }), moves.end());
+
+    if (moves.empty()) return;
+
+    uint64_t best = 0;
+    for (const Record& r : moves) best = std::max<uint64_t>(best, 2ull * r.stats.wins + r.stats.draws);
+
+    // most played first, the order Polyglot tools list moves in
+    std::stable_sort(moves.begin(), moves.end(), [](const Record& a, const Record& b) { return 2ull * a.stats.wins + a.stats.draws > 2ull * b.stats.wins + b.stats.draws; });
+
+    for (const Record& r : moves)
+    {
+        const uint64_t score = 2ull * r.stats.wins + r.stats.draws;
+        const uint64_t weight = std::max<uint64_t>(1, best > 0xFFFF ? score * 0xFFFF / best : score);
+
+        writeBig(out, r.key, 8);
+        writeBig(out, r.move, 2);
+        writeBig(out, weight, 2);
+        writeBig(out, 0, 4);
+        ++written;
+    }
+}
+
+// k-way merge of the sorted runs, adding up equal (position, move) pairs
+static uint64_t merge(const std::vector<std::string>& runs, const std::string& output, const uint32_t min_games)
+{
+    std::vector<RunReader> readers;
+    readers.reserve(runs.size());
+    for (const std::string& path : runs) readers.emplace_back(path);
+
+    const auto later = [&](const size_t a, const size_t b) { return readers[b].current < readers[a].current; };
+    std::priority_queue<size_t, std::vector<size_t>, decltype(later)> queue(later);
+
+    for (size_t i = 0; i < readers.size(); ++i)
+        if (readers[i].valid) queue.push(i);
+
+    std::ofstream out(output, std::ios::binary);
+    std::vector<Record> position;
+    uint64_t written = 0;
+
+    while (!queue.empty())
+    {
+        const size_t i = queue.top();
+        queue.pop();
+
+        const Record r = readers[i].current;
+        if (readers[i].next()) queue.push(i);
+
+        if (!position.empty() && position.front().key != r.key) writePosition(out, position, min_games, written), position.clear();
+
+        if (!position.empty() && position.back().move == r.move)
+        {
+            position.back().stats.wins += r.stats.wins;
+            position.back().stats.draws += r.stats.draws;
+            position.back().stats.games += r.stats.games;
+        }
+        else position.push_back(r);
+    }
+
+    writePosition(out, position, min_games, written);
+
+    if (!out)
+    {
+        std::cerr << "cannot write " << output << "\n";
+        std::exit(1);
+    }
+
+    return written;
+}
+
+static Options parse(int argc, char** argv)
+{
+    Options options;
+
+    for (int i = 1; i < argc; ++i)
+    {
+        const std::string arg = argv[i];
+        const bool has_value = i + 1 < argc;
+
+        if (arg == "--ply" && has_value) options.ply = std::atoi(argv[++i]);
+        else if (arg == "--min-games" && has_value) options.min_games = static_cast<uint32_t>(std::max(1, std::atoi(argv[++i])));
+        else if (arg == "--threads" && has_value) options.threads = static_cast<unsigned>(std::max(0, std::atoi(argv[++i])));
+        else if (arg == "--memory" && has_value) options.memory_mb = static_cast<size_t>(std::max(1, std::atoi(argv[++i])));
+        else if (options.output.empty()) options.output = arg;
+        else options.inputs.push_back(arg);
+    }
+
+    return options;
+}
+
+int main(int argc, char** argv)
+{
+    const Options options = parse(argc, argv);
+
+    if (options.output.empty() || options.inputs.empty())
+    {
+        std::cerr << "usage: book_builder <book.bin> <games.pgn>... [--ply N] [--min-games N] [--threads N] [--memory MB]\n";
+        return 1;
+    }
+
+    ShardedMap map(options.output + ".run", options.memory_mb);
+
+    for (const std::string& input : options.inputs)
+    {
+        pgn::ParallelStreamParser parser(input, options.threads);
+        std::vector<std::unique_ptr<BookVisitor>> visitors;
+
+        if (parser.readGames(visitors, &map, options.ply) != pgn::StreamParserError::None)
+            std::cerr << "warning: " << input << " could not be parsed completely\n";
+    }
+
+    // visitors flushed their last games when they were destroyed
+    map.spill();
+
+    const uint64_t entries = merge(map.runFiles(), options.output, options.min_games);
+
+    for (const std::string& path : map.runFiles()) std::remove(path.c_str());
+
+    std::cout << "wrote " << entries << " entries from " << map.runFiles().size() << " runs to " << options.output << "\n";
+
+    return 0;
+}
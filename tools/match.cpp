@@ -0,0 +1,539 @@
+// Plays engine A against engine B over UCI and tests the score with an SPRT.
+//
+//   g++ -std=c++17 -O2 -pthread tools/match.cpp -o match
+//   ./match --engine ./new --engine ./old --openings book.epd [--games 20000] [--concurrency N]
+//           [--tc 8+0.08] [--hash 16] [--sprt 0 5] [--alpha 0.05] [--beta 0.05] [--margin 0] [--maxplies 400]
+//
+// Every worker thread owns one engine pair and plays games back to back, so
+// --concurrency pairs keep that many cores busy (only one engine of a pair is
+// thinking at a time). Engines are started once and reused with ucinewgame.
+// Each opening is played twice with colours reversed. Openings come from an EPD
+// file, one position per line, or from the games of a PGN file. The referee
+// keeps the clock with steady_clock around go/bestmove and uses Board for move
+// legality and isGameOver(). Results are reported after every game together with
+// Elo, LOS and the log-likelihood ratio of a trinomial GSPRT of elo0 against
+// elo1, and the match stops as soon as the SPRT accepts either hypothesis.
+//
+// Engines are started through /bin/sh with pipes, so this tool needs a POSIX system.
+#if defined(_WIN32)
+#error "the match runner needs POSIX pipes and fork"
+#endif
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cmath>
+#include <csignal>
+#include <fstream>
+#include <iomanip>
+#include <iostream>
+#include <memory>
+#include <mutex>
+#include <sstream>
+#include <string>
+#include <thread>
+#include <vector>
+#include <poll.h>
+#include <sys/wait.h>
+#include <unistd.h>
+#include "../chess.hpp"
+
+using namespace chess;
+using Clock = std::chrono::steady_clock;
+
+struct Options
+{
+    std::vector<std::string> engines;
+    std::string openings;
+    int64_t games = 20000;
+    unsigned concurrency = std::max(1u, std::thread::hardware_concurrency());
+    int64_t base_ms = 8000;
+    int64_t inc_ms = 80;
+    int hash = 16;
+    double elo0 = 0;
+    double elo1 = 5;
+    double alpha = 0.05;
+    double beta = 0.05;
+    int64_t margin_ms = 0;
+    int max_plies = 400;
+};
+
+// A start position and the moves played from it
+struct Opening
+{
+    std::string fen;
+    std::vector<std::string> moves;
+};
+
+// A UCI engine running in a child process, talked to over two pipes
+class Engine
+{
+public:
+    explicit Engine(const std::string& command)
+    {
+        int in[2], out[2];
+
+        if (pipe(in) != 0 || pipe(out) != 0) return;
+
+        pid = fork();
+
+        if (pid == 0)
+        {
+            dup2(in[0], STDIN_FILENO);
+            dup2(out[1], STDOUT_FILENO);
+            close(in[0]), close(in[1]), close(out[0]), close(out[1]);
+            execl("/bin/sh", "sh", "-c", ("exec " + command).c_str(), static_cast<char*>(nullptr));
+            _exit(127);
+        }
+
+        close(in[0]), close(out[1]);
+        to_engine = in[1];
+        from_engine = out[0];
+        alive = pid > 0;
+    }
+
+    ~Engine()
+    {
+        send("quit");
+        if (to_engine >= 0) close(to_engine);
+        if (from_engine >= 0) close(from_engine);
+
+        // Give the engine a moment to exit on its own
+        for (int i = 0; i < 100 && pid > 0; ++i)
+        {
+            if (waitpid(pid, nullptr, WNOHANG) != 0) return;
+            std::this_thread::sleep_for(std::chrono::milliseconds(10));
+        }
+
+        if (pid > 0)
+        {
+            kill(pid, SIGKILL);
+            waitpid(pid, nullptr, 0);
+        }
+    }
+
+    Engine(const Engine&) = delete;
+    Engine& operator=(const Engine&) = delete;
+
+    void send(const std::string& line)
+    {
+        const std::string data = line + "\n";
+
+        for (size_t done = 0; alive && done < data.size();)
+        {
+            const ssize_t n = write(to_engine, data.data() + done, data.size() - done);
+            if (n <= 0) alive = false;
+            else done += static_cast<size_t>(n);
+        }
+    }
+
+    // Reads one line, false if it did not arrive before the deadline or the engine exited
+    bool readLine(std::string& line, const Clock::time_point deadline)
+    {
+        while (alive)
+        {
+            const size_t end = buffer.find('\n');
+
+            if (end != std::string::npos)
+            {
+                line = buffer.substr(0, end);
+                if (!line.empty() && line.back() == '\r') line.pop_back();
+                buffer.erase(0, end + 1);
+                return true;
+            }
+
+            const int64_t wait = std::chrono::duration_cast<std::chrono::milliseconds>(deadline - Clock::now()).count();
+            if (wait < 0) return false;
+
+            pollfd fd = { from_engine, POLLIN, 0 };
+            const int ready = poll(&fd, 1, static_cast<int>(std::min<int64_t>(wait + 1, 1000)));
+
+            if (ready < 0) alive = false;
+            else if (ready > 0)
+            {
+                char chunk[4096];
+                const ssize_t n = read(from_engine, chunk, sizeof(chunk));
+                if (n <= 0) alive = false;
+                else buffer.append(chunk, static_cast<size_t>(n));
+            }
+        }
+
+        return false;
+    }
+
+    // Reads until a line starting with token, returns that line or an empty string
+    std::string waitFor(const std::string& token, const Clock::time_point deadline)
+    {
+        std::string line;
+
+        while (readLine(line, deadline))
+            if (line.compare(0, token.size(), token) == 0) return line;
+
+        return "";
+    }
+
+    bool alive = false;
+
+private:
+    pid_t pid = -1;
+    int to_engine = -1;
+    int from_engine = -1;
+    std::string buffer;
+};
+
+// Game result from engine A's point of view; an engine that stops answering (not ready, or no
+// bestmove even after stop) loses the game, so a build that crashes cannot pass by dropping games
+struct Outcome
+{
+    int score;
+    std::string reason;
+    bool crashed = false;
+};
+
+// Returns nullptr if the engine does not answer uci
+static std::unique_ptr<Engine> startEngine(const std::string& command, const Options& options)
+{
+    auto engine = std::make_unique<Engine>(command);
+    engine->send("uci");
+
+    if (engine->waitFor("uciok", Clock::now() + std::chrono::seconds(10)).empty())
+    {
+        std::cerr << "engine " << command << " did not answer uci\n";
+        return nullptr;
+    }
+
+    engine->send("setoption name Hash value " + std::to_string(options.hash));
+    return engine;
+}
+
+static Outcome playGame(Engine& a, Engine& b, const bool a_white, const Opening& opening, const Options& options)
+{
+    Engine* engines[2] = { a_white ? &a : &b, a_white ? &b : &a };
+    const int a_color = a_white ? 0 : 1;
+
+    for (Engine* e : engines)
+    {
+        e->send("ucinewgame");
+        e->send("isready");
+        if (e->waitFor("readyok", Clock::now() + std::chrono::seconds(10)).empty())
+        {
+            e->alive = false;
+            return { e == &a ? -1 : 1, "engine not ready", true };
+        }
+    }
+
+    Board board;
+    board.setFen(opening.fen);
+
+    std::string position = "position fen " + opening.fen + " moves";
+
+    for (const std::string& i : opening.moves)
+    {
+        board.makeMove(uci::uciToMove(board, i));
+        position += " " + i;
+    }
+
+    int64_t clock[2] = { options.base_ms, options.base_ms };
+
+    for (int ply = 0;; ++ply)
+    {
+        const auto [reason, result] = board.isGameOver();
+        const int stm = board.sideToMove() == Color::WHITE ? 0 : 1;
+
+        if (reason != GameResultReason::NONE)
+        {
+            // isGameOver() only reports losses for the side to move
+            if (result == GameResult::LOSE) return { stm == a_color ? -1 : 1, "checkmate" };
+            return { 0, reason == GameResultReason::STALEMATE ? "stalemate" : reason == GameResultReason::THREEFOLD_REPETITION ? "repetition" : reason == GameResultReason::FIFTY_MOVE_RULE ? "fifty moves" : "insufficient material" };
+        }
+
+        if (ply >= options.max_plies) return { 0, "max plies" };
+
+        Engine& engine = *engines[stm];
+        engine.send(position);
+
+        std::ostringstream go;
+        go << "go wtime " << std::max<int64_t>(1, clock[0]) << " btime " << std::max<int64_t>(1, clock[1]) << " winc " << options.inc_ms << " binc " << options.inc_ms;
+
+        const Clock::time_point start = Clock::now();
+        engine.send(go.str());
+
+        const std::string line = engine.waitFor("bestmove", start + std::chrono::milliseconds(clock[stm] + options.margin_ms));
+        const int64_t elapsed = std::chrono::duration_cast<std::chrono::milliseconds>(Clock::now() - start).count();
+
+        const int lose = stm == a_color ? -1 : 1;
+
+        if (line.empty() || elapsed > clock[stm] + options.margin_ms)
+        {
+            // The engine may still be thinking, end its search before the next game
+            engine.send("stop");
+            if (engine.waitFor("bestmove", Clock::now() + std::chrono::seconds(5)).empty())
+            {
+                engine.alive = false;
+                return { lose, "engine crashed", true };
+            }
+
+            return { lose, "time forfeit" };
+        }
+
+        clock[stm] += options.inc_ms - elapsed;
+
+        std::istringstream iss(line);
+        std::string token, move_str;
+        iss >> token >> move_str;
+
+        const Move move = uci::uciToMove(board, move_str);
+        Movelist legal;
+        movegen::legalmoves(legal, board);
+
+        if (std::find(legal.begin(), legal.end(), move) == legal.end()) return { lose, "illegal move " + move_str };
+
+        board.makeMove(move);
+        position += " " + move_str;
+    }
+}
+
+// Online statistics of the match
+class Stats
+{
+public:
+    explicit Stats(const Options& options) : options(options) {}
+
+    // Adds a game and prints the standings, returns true once the SPRT has decided
+    bool add(const Outcome& outcome)
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+
+        if (decided) return true;
+
+        if (outcome.score > 0) ++wins;
+        else if (outcome.score < 0) ++losses;
+        else ++draws;
+
+        crashes += outcome.crashed;
+
+        const double n = static_cast<double>(wins + draws + losses);
+        const double score = (wins + 0.5 * draws) / n;
+        const double var = (wins * std::pow(1 - score, 2) + draws * std::pow(0.5 - score, 2) + losses * std::pow(score, 2)) / n;
+        const double margin = 1.96 * std::sqrt(var / n);
+
+        const double los = wins + losses > 0 ? 0.5 * (1 + std::erf((wins - losses) / std::sqrt(2.0 * (wins + losses)))) : 0.5;
+
+        // Trinomial GSPRT with logistic Elo, see Michel Van den Bergh's notes on the SPRT
+        const double s0 = expectedScore(options.elo0);
+        const double s1 = expectedScore(options.elo1);
+        const double llr = var > 0 ? n * (s1 - s0) * (2 * score - s0 - s1) / (2 * var) : 0;
+        const double lower = std::log(options.beta / (1 - options.alpha));
+        const double upper = std::log((1 - options.beta) / options.alpha);
+
+        std::cout << std::fixed << std::setprecision(2)
+                  << "games " << static_cast<int64_t>(n) << " +" << wins << " =" << draws << " -" << losses
+                  << " (" << outcome.reason << ") crashes " << crashes
+                  << " elo " << elo(score) << " +- " << (elo(std::min(0.999, score + margin)) - elo(std::max(0.001, score - margin))) / 2
+                  << " los " << 100 * los << "%"
+                  << " llr " << llr << " [" << lower << ", " << upper << "]" << std::endl;
+
+        if (llr >= upper) std::cout << "SPRT: H1 accepted, elo1 " << options.elo1 << std::endl;
+        else if (llr <= lower) std::cout << "SPRT: H0 accepted, elo0 " << options.elo0 << std::endl;
+        else return false;
+
+        decided = true;
+        return true;
+    }
+
+private:
+    static double expectedScore(const double elo) { return 1 / (1 + std::pow(10, -elo / 400)); }
+
+    static double elo(const double score) { return score <= 0 || score >= 1 ? 0 : -400 * std::log10(1 / score - 1); }
+
+    const Options& options;
+    std::mutex mutex;
+    int64_t wins = 0;
+    int64_t draws = 0;
+    int64_t losses = 0;
+    int64_t crashes = 0;
+    bool decided = false;
+};
+
+// Collects the start position and moves of every game
+class OpeningVisitor : public pgn::Visitor
+{
+public:
+    explicit OpeningVisitor(std::vector<Opening>& openings) : openings(openings) {}
+
+    void startPgn() override
+    {
+        current = { std::string(constants::STARTPOS), {} };
+        board.setFen(constants::STARTPOS);
+        broken = false;
+    }
+
+    void header(std::string_view key, std::string_view value) override
+    {
+        if (key == "FEN")
+        {
+            current.fen = std::string(value);
+            board.setFen(value);
+        }
+    }
+
+    void startMoves() override {}
+
+    void move(std::string_view san, std::string_view) override
+    {
+        if (san.empty() || broken) return;
+
+        try
+        {
+            const Move move = uci::parseSan(board, san, scratch);
+            current.moves.push_back(uci::moveToUci(move));
+            board.makeMove(move);
+        }
+        catch (const std::exception&)
+        {
+            // keep the moves up to the first one that does not parse
+            broken = true;
+        }
+    }
+
+    void endPgn() override { openings.push_back(current); }
+
+private:
+    std::vector<Opening>& openings;
+    Opening current;
+    Board board;
+    Movelist scratch;
+    bool broken = false;
+};
+
+static std::vector<Opening> loadOpenings(const std::string& path)
+{
+    std::vector<Opening> openings;
+
+    if (path.empty())
+    {
+        openings.push_back({ std::string(constants::STARTPOS), {} });
+        return openings;
+    }
+
+    std::ifstream file(path);
+
+    if (path.size() >= 4 && path.compare(path.size() - 4, 4, ".pgn") == 0)
+    {
+        OpeningVisitor visitor(openings);
+        pgn::StreamParser parser(file);
+
+        if (parser.readGames(visitor) != pgn::StreamParserError::None) std::cerr << "warning: " << path << " could not be parsed completely\n";
+    }
+
+    else
+    {
+        std::string line;
+        Board board;
+
+        while (std::getline(file, line))
+            if (board.setEpd(line)) openings.push_back({ board.getFen(), {} });
+    }
+
+    return openings;
+}
+
+static Options parse(int argc, char** argv)
+{
+    Options options;
+
+    for (int i = 1; i < argc; ++i)
+    {
+        const std::string arg = argv[i];
+        const bool has_value = i + 1 < argc;
+
+        if (arg == "--engine" && has_value) options.engines.push_back(argv[++i]);
+        else if (arg == "--openings" && has_value) options.openings = argv[++i];
+        else if (arg == "--games" && has_value) options.games = std::atoll(argv[++i]);
+        else if (arg == "--concurrency" && has_value) options.concurrency = static_cast<unsigned>(std::max(1, std::atoi(argv[++i])));
+        else if (arg == "--hash" && has_value) options.hash = std::atoi(argv[++i]);
+        else if (arg == "--alpha" && has_value) options.alpha = std::atof(argv[++i]);
+        else if (arg == "--beta" && has_value) options.beta = std::atof(argv[++i]);
+        else if (arg == "--margin" && has_value) options.margin_ms = std::atoll(argv[++i]);
+        else if (arg == "--maxplies" && has_value) options.max_plies = std::atoi(argv[++i]);
+
+        else if (arg == "--sprt" && i + 2 < argc)
+        {
+            options.elo0 = std::atof(argv[++i]);
+            options.elo1 = std::atof(argv[++i]);
+        }
+
+        // base+increment in seconds
+        else if (arg == "--tc" && has_value)
+        {
+            const std::string tc = argv[++i];
+            const size_t plus = tc.find('+');
+            options.base_ms = static_cast<int64_t>(std::atof(tc.substr(0, plus).c_str()) * 1000);
+            options.inc_ms = plus == std::string::npos ? 0 : static_cast<int64_t>(std::atof(tc.substr(plus + 1).c_str()) * 1000);
+        }
+    }
+
+    return options;
+}
+
+int main(int argc, char** argv)
+{
+    const Options options = parse(argc, argv);
+
+    if (options.engines.size() != 2)
+    {
+        std::cerr << "usage: match --engine <a> --engine <b> [--openings book.epd|book.pgn] [--games N] [--concurrency N]\n"
+                  << "             [--tc base+inc] [--hash MB] [--sprt elo0 elo1] [--alpha A] [--beta B] [--margin ms] [--maxplies N]\n";
+        return 1;
+    }
+
+    // A crashed engine must not take the runner down with it
+    std::signal(SIGPIPE, SIG_IGN);
+
+    const std::vector<Opening> openings = loadOpenings(options.openings);
+
+    if (openings.empty())
+    {
+        std::cerr << "no openings in " << options.openings << "\n";
+        return 1;
+    }
+
+    Stats stats(options);
+    std::atomic<int64_t> next_game = 0;
+    std::atomic<bool> done = false;
+    std::atomic<unsigned> dead = 0;
+    std::vector<std::thread> workers;
+
+    for (unsigned t = 0; t < options.concurrency; ++t)
+    {
+        workers.emplace_back([&, t]()
+        {
+            std::unique_ptr<Engine> a = startEngine(options.engines[0], options);
+            std::unique_ptr<Engine> b = a ? startEngine(options.engines[1], options) : nullptr;
+
+            for (int64_t game; a && b && !done && (game = next_game.fetch_add(1)) < options.games;)
+            {
+                // Both colours of an opening are consecutive games
+                const Opening& opening = openings[static_cast<size_t>(game / 2) % openings.size()];
+                const Outcome outcome = playGame(*a, *b, game % 2 == 0, opening, options);
+
+                if (stats.add(outcome)) done = true;
+
+                // Replace an engine that crashed or hangs
+                if (!a->alive) a = startEngine(options.engines[0], options);
+                if (a && !b->alive) b = startEngine(options.engines[1], options);
+            }
+
+            // An engine that cannot be restarted stops this worker only, the others play on
+            if (!a || !b)
+            {
+                std::cerr << "worker " << t + 1 << " stopped\n";
+                ++dead;
+            }
+        });
+    }
+
+    for (std::thread& i : workers) i.join();
+
+    return dead == options.concurrency ? 1 : 0;
+}
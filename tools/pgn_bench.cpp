@@ -0,0 +1,151 @@
+// PGN ingestion throughput benchmark.
+//
+//   g++ -std=c++17 -O2 -march=native tools/pgn_bench.cpp -o pgn_bench
+//   ./pgn_bench games.pgn
+//
+// The file is parsed with a visitor that only counts tokens, which measures
+// pgn::StreamParser alone, then resolving every SAN move with uci::parseSan()
+// and playing it on a board, the way game converters do. The replay is run
+// serially and with pgn::ParallelStreamParser on all hardware threads.
+#include <chrono>
+#include <cstdlib>
+#include <fstream>
+#include <iostream>
+#include <memory>
+#include <string>
+#include <vector>
+#include "../chess.hpp"
+
+using namespace chess;
+
+class CountVisitor : public pgn::Visitor
+{
+public:
+    void startPgn() override { games++; }
+    void header(std::string_view, std::string_view) override {}
+    void startMoves() override {}
+    void move(std::string_view, std::string_view) override { moves++; }
+    void endPgn() override {}
+
+    uint64_t games = 0;
+    uint64_t moves = 0;
+};
+
+class ReplayVisitor : public CountVisitor
+{
+public:
+    void startPgn() override
+    {
+        CountVisitor::startPgn();
+        board.setFen(constants::STARTPOS);
+    }
+
+    void header(std::string_view key, std::string_view value) override
+    {
+        if (key == "FEN") board.setFen(value);
+    }
+
+    void move(std::string_view san, std::string_view) override
+    {
+        moves++;
+
+        try
+        {
+            board.makeMove(uci::parseSan(board, san, scratch));
+        }
+        catch (const std::exception&)
+        {
+            errors++;
+            skipPgn(true);
+        }
+    }
+
+    Board board;
+    Movelist scratch;
+    uint64_t errors = 0;
+};
+
+struct Result
+{
+    uint64_t games = 0;
+    uint64_t moves = 0;
+    uint64_t errors = 0;
+};
+
+static void report(const char* name, const Result& result, double seconds)
+{
+    std::cout << name << ": " << result.games << " games, " << result.moves << " moves in " << seconds << " s, "
+              << static_cast<uint64_t>(result.games / seconds) << " games/s, "
+              << static_cast<uint64_t>(result.moves / seconds) << " moves/s\n";
+
+    if (result.errors) std::cout << result.errors << " games skipped on unparsable moves\n";
+}
+
+template <typename V>
+static Result run(const char* name, const char* path)
+{
+    std::ifstream file(path, std::ios::binary);
+
+    if (!file)
+    {
+        std::cerr << "cannot open " << path << "\n";
+        std::exit(1);
+    }
+
+    V visitor;
+    pgn::StreamParser parser(file);
+
+    const auto start = std::chrono::steady_clock::now();
+    parser.readGames(visitor);
+    const double seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+
+    Result result{ visitor.games, visitor.moves };
+    if constexpr (std::is_same_v<V, ReplayVisitor>) result.errors = visitor.errors;
+
+    report(name, result, seconds);
+
+    return result;
+}
+
+static Result runParallel(const char* name, const char* path)
+{
+    const auto start = std::chrono::steady_clock::now();
+
+    pgn::ParallelStreamParser parser(path);
+    std::vector<std::unique_ptr<ReplayVisitor>> visitors;
+    parser.readGames(visitors);
+
+    // merged in file order
+    Result result;
+    for (const auto& visitor : visitors)
+    {
+        result.games += visitor->games;
+        result.moves += visitor->moves;
+        result.errors += visitor->errors;
+    }
+
+    report(name, result, std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count());
+
+    return result;
+}
+
+int main(int argc, char** argv)
+{
+    if (argc < 2)
+    {
+        std::cerr << "usage: pgn_bench <file.pgn>\n";
+        return 1;
+    }
+
+    run<CountVisitor>("tokenize       ", argv[1]);
+    const Result serial = run<ReplayVisitor>("replay         ", argv[1]);
+    const Result parallel = runParallel("replay parallel", argv[1]);
+
+    if (serial.games != parallel.games || serial.moves != parallel.moves)
+    {
+        std::cout << "parallel and serial results differ\n";
+        return 1;
+    }
+
+    return 0;
+}
@@ -0,0 +1,105 @@
+// Slider lookup latency microbenchmark.
+//
+// Build once per table layout and compare:
+//   g++ -std=c++17 -O2 -march=native tools/slider_bench.cpp -o slider_bench
+//   g++ -std=c++17 -O2 -march=native -DCHESS_COMPACT_ATTACKS tools/slider_bench.cpp -o slider_bench_compact
+//
+// Every lookup depends on the previous result, so the timings are latencies
+// rather than throughput. The "pressure" run touches a random line of a large
+// buffer between lookups, the way transposition table probes do in a search;
+// the walk alone is timed first, a step well above a few ns means it misses.
+#include <chrono>
+#include <cstdlib>
+#include <iostream>
+#include <random>
+#include <vector>
+#include "../chess.hpp"
+
+using namespace chess;
+
+static constexpr int lookups = 1 << 23;
+
+struct Sample
+{
+    Square sq;
+    Bitboard occ;
+};
+
+static double run(const std::vector<Sample>& samples, std::vector<uint64_t>& buffer, bool pressure)
+{
+    const uint64_t mask = buffer.size() - 1;
+    uint64_t chain = 0;
+    // xorshift never leaves a zero state, so the walk needs a nonzero seed
+    uint64_t line = 0x9E3779B97F4A7C15ull;
+
+    const auto start = std::chrono::steady_clock::now();
+
+    for (int i = 0; i < lookups; i++)
+    {
+        const Sample& s = samples[(i ^ chain) & (samples.size() - 1)];
+        const Bitboard occ = s.occ ^ Bitboard(chain & 1);
+        chain = (attacks::rook(s.sq, occ) ^ attacks::bishop(s.sq, occ)).getBits();
+
+        if (pressure)
+        {
+            // xorshift walk over the buffer, 8 entries per 64 byte line
+            line ^= line << 13, line ^= line >> 7, line ^= line << 17;
+            buffer[(line * 8) & mask] += chain;
+        }
+    }
+
+    const auto elapsed = std::chrono::duration<double, std::nano>(std::chrono::steady_clock::now() - start).count();
+
+    // keep the chain observable so the loop cannot be removed
+    if (chain == 42) std::cout << "";
+
+    return elapsed / lookups;
+}
+
+// The buffer walk of the pressure run without lookups, what the cache misses cost alone
+static double walk(std::vector<uint64_t>& buffer)
+{
+    const uint64_t mask = buffer.size() - 1;
+    uint64_t line = 0x9E3779B97F4A7C15ull;
+
+    const auto start = std::chrono::steady_clock::now();
+
+    for (int i = 0; i < lookups; i++)
+    {
+        line ^= line << 13, line ^= line >> 7, line ^= line << 17;
+        buffer[(line * 8) & mask] += line;
+    }
+
+    return std::chrono::duration<double, std::nano>(std::chrono::steady_clock::now() - start).count() / lookups;
+}
+
+int main(int argc, char** argv)
+{
+    // size of the pressure buffer in MB, a power of two
+    const int mb = argc > 1 ? std::atoi(argv[1]) : 64;
+
+    std::mt19937_64 rng(0x5eed);
+    std::vector<Sample> samples(1 << 16);
+
+    for (auto& s : samples)
+    {
+        s.sq = Square(static_cast<int>(rng() % 64));
+        s.occ = Bitboard(rng() & rng());
+    }
+
+    std::vector<uint64_t> buffer(static_cast<size_t>(mb) * 1024 * 1024 / sizeof(uint64_t), 1);
+
+    std::cout << "buffer walk alone " << walk(buffer) << " ns/step (" << mb << " MB buffer)\n";
+
+    for (const auto backend : { SliderBackend::MAGIC, SliderBackend::PEXT, SliderBackend::COMPACT })
+    {
+        // backends not available in this build or on this CPU are skipped
+        if (!attacks::setSliderBackend(backend)) continue;
+
+        std::cout << attacks::sliderBackendName() << "\n";
+        std::cout << "  idle     " << run(samples, buffer, false) << " ns/lookup\n";
+        std::cout << "  pressure " << run(samples, buffer, true) << " ns/lookup (" << mb << " MB buffer)\n";
+    }
+
+    return 0;
+}
@@ -0,0 +1,312 @@
+#ifndef TRAINING_DATA_HPP
+#define TRAINING_DATA_HPP
+
+#include <algorithm>
+#include <cstdint>
+#include <fstream>
+#include <string>
+#include <vector>
+#include "chess.hpp"
+
+// One labelled position as written by datagen, 30 bytes on disk
+// Score and result are from the side to move's point of view
+struct TrainingEntry
+{
+    chess::PackedBoard board;
+    int16_t score;
+    uint16_t ply;
+    int8_t result;
+    uint8_t padding;
+};
+
+static_assert(sizeof(TrainingEntry) == 30, "TrainingEntry is written as raw bytes");
+
+// A searched position of a self-play game, the move played and its score for the side to move
+struct TrainingMove
+{
+    chess::Move move;
+    int16_t score;
+    bool quiet;
+};
+
+// A self-play game from the position its searched moves start at
+struct TrainingGame
+{
+    chess::Board start;
+    uint16_t start_ply = 0;
+    int8_t white_result = 0;
+    std::vector<TrainingMove> moves;
+};
+
+// Packed writes a TrainingEntry per quiet position
+// Chain writes a game as its start position followed by one move index and score delta per position
+enum class TrainingFormat { PACKED, CHAIN };
+
+namespace chain
+{
+    // Chain layout, little endian:
+    // PackedBoard start | start ply 16 | white result 8 | moves 16 | payload bytes 32 | payload
+    // Every move in the payload is a quiet flag, the index of the move among the legal moves
+    // sorted by their encoding in just enough bits for the move count, and the score plus
+    // the previous score (the side to move alternates) as an exp-Golomb coded zigzag number
+    static constexpr size_t header_size = 24 + 2 + 1 + 2 + 4;
+    static constexpr int golomb_order = 4;
+
+    // Legal moves in a fixed order, so the indices do not depend on the generation order
+    inline void sortedMoves(chess::Movelist& moves, const chess::Board& board)
+    {
+        chess::movegen::legalmoves(moves, board);
+        std::sort(moves.begin(), moves.end(), [](const chess::Move& a, const chess::Move& b) { return a.move() < b.move(); });
+    }
+
+    inline int indexBits(const int count)
+    {
+        int bits = 0;
+        while ((1 << bits) < count) ++bits;
+        return bits;
+    }
+
+    inline uint32_t zigzag(const int32_t value) { return (static_cast<uint32_t>(value) << 1) ^ static_cast<uint32_t>(value >> 31); }
+
+    inline int32_t unzigzag(const uint32_t value) { return static_cast<int32_t>(value >> 1) ^ -static_cast<int32_t>(value & 1); }
+
+    class BitWriter
+    {
+    public:
+        void write(const uint32_t value, const int bits)
+        {
+            for (int i = 0; i < bits; ++i)
+            {
+                if (used % 8 == 0) bytes.push_back(0);
+                bytes.back() |= static_cast<uint8_t>((value >> i & 1) << (used % 8));
+                ++used;
+            }
+        }
+
+        void writeGolomb(const uint32_t value)
+        {
+            const uint64_t m = uint64_t(value) + (1u << golomb_order);
+            int width = 0;
+            while ((m >> width) > 1) ++width;
+
+            write(0, width - golomb_order);
+            write(1, 1);
+            write(static_cast<uint32_t>(m), width);
+        }
+
+        std::vector<uint8_t> bytes;
+
+    private:
+        size_t used = 0;
+    };
+
+    class BitReader
+    {
+    public:
+        BitReader(const uint8_t* data, const size_t size) : data(data), size(size) {}
+
+        uint32_t read(const int bits)
+        {
+            uint32_t value = 0;
+
+            for (int i = 0; i < bits; ++i, ++used)
+                if (used / 8 < size) value |= uint32_t(data[used / 8] >> (used % 8) & 1) << i;
+
+            return value;
+        }
+
+        uint32_t readGolomb()
+        {
+            int zeros = 0;
+            while (used / 8 < size && read(1) == 0) ++zeros;
+
+            const int width = zeros + golomb_order;
+            return static_cast<uint32_t>(((uint64_t(1) << width) | read(width)) - (1u << golomb_order));
+        }
+
+    private:
+        const uint8_t* data;
+        size_t size;
+        size_t used = 0;
+    };
+
+    inline void put(std::vector<uint8_t>& out, const uint64_t value, const int bytes)
+    {
+        for (int i = 0; i < bytes; ++i) out.push_back(static_cast<uint8_t>(value >> (8 * i)));
+    }
+
+    inline uint64_t get(const uint8_t* in, const int bytes)
+    {
+        uint64_t value = 0;
+        for (int i = 0; i < bytes; ++i) value |= uint64_t(in[i]) << (8 * i);
+        return value;
+    }
+}
+
+// Buffered writer owned by a single thread, so writing needs no locks
+class TrainingWriter
+{
+public:
+    TrainingWriter(const std::string& path, const TrainingFormat format) : out(path, std::ios::binary), format(format) { buffer.reserve(capacity); }
+
+    ~TrainingWriter() { flush(); }
+
+    TrainingWriter(const TrainingWriter&) = delete;
+    TrainingWriter& operator=(const TrainingWriter&) = delete;
+
+    void write(const TrainingGame& game)
+    {
+        if (format == TrainingFormat::CHAIN) writeChain(game);
+        else writePacked(game);
+
+        if (buffer.size() >= capacity) flush();
+    }
+
+    void flush()
+    {
+        out.write(reinterpret_cast<const char*>(buffer.data()), static_cast<std::streamsize>(buffer.size()));
+        out.flush();
+        buffer.clear();
+    }
+
+    bool good() const { return static_cast<bool>(out); }
+
+private:
+    void writePacked(const TrainingGame& game)
+    {
+        chess::Board board = game.start;
+        uint16_t ply = game.start_ply;
+
+        for (const TrainingMove& i : game.moves)
+        {
+            if (i.quiet)
+            {
+                const int8_t result = static_cast<int8_t>(board.sideToMove() == chess::Color::WHITE ? game.white_result : -game.white_result);
+                const TrainingEntry entry = { chess::Board::Compact::encode(board), i.score, ply, result, 0 };
+                const uint8_t* bytes = reinterpret_cast<const uint8_t*>(&entry);
+                buffer.insert(buffer.end(), bytes, bytes + sizeof(TrainingEntry));
+            }
+
+            board.makeMove(i.move);
+            ++ply;
+        }
+    }
+
+    void writeChain(const TrainingGame& game)
+    {
+        chess::Board board = game.start;
+        chess::Movelist moves;
+        chain::BitWriter bits;
+        int previous = 0;
+
+        for (const TrainingMove& i : game.moves)
+        {
+            chain::sortedMoves(moves, board);
+            const int index = static_cast<int>(std::find(moves.begin(), moves.end(), i.move) - moves.begin());
+
+            bits.write(i.quiet, 1);
+            bits.write(static_cast<uint32_t>(index), chain::indexBits(moves.size()));
+            bits.writeGolomb(chain::zigzag(i.score + previous));
+
+            previous = i.score;
+            board.makeMove(i.move);
+        }
+
+        const chess::PackedBoard packed = chess::Board::Compact::encode(game.start);
+        buffer.insert(buffer.end(), packed.begin(), packed.end());
+        chain::put(buffer, game.start_ply, 2);
+        chain::put(buffer, static_cast<uint8_t>(game.white_result), 1);
+        chain::put(buffer, game.moves.size(), 2);
+        chain::put(buffer, bits.bytes.size(), 4);
+        buffer.insert(buffer.end(), bits.bytes.begin(), bits.bytes.end());
+    }
+
+    // About 1 MB per write
+    static constexpr size_t capacity = 1 << 20;
+
+    std::ofstream out;
+    TrainingFormat format;
+    std::vector<uint8_t> buffer;
+};
+
+// Streams the positions of a chain file, each game is replayed from its start with makeMove
+// Every searched position is returned, quiet() tells the ones a packed file would hold
+class ChainReader
+{
+public:
+    explicit ChainReader(const std::string& path) : in(path, std::ios::binary) {}
+
+    // Moves to the next position, false at the end of the file or on a damaged chain
+    bool next()
+    {
+        if (remaining > 0)
+        {
+            board_.makeMove(move_);
+            ++ply_;
+        }
+
+        while (remaining == 0)
+        {
+            if (!readChain()) return false;
+        }
+
+        chain::sortedMoves(moves, board_);
+        quiet_ = bits.read(1);
+        const uint32_t index = bits.read(chain::indexBits(moves.size()));
+
+        if (index >= static_cast<uint32_t>(moves.size())) return false;
+
+        move_ = moves[static_cast<int>(index)];
+        score_ = chain::unzigzag(bits.readGolomb()) - score_;
+        --remaining;
+
+        return true;
+    }
+
+    const chess::Board& board() const { return board_; }
+    chess::Move move() const { return move_; }
+    int score() const { return score_; }
+    int ply() const { return ply_; }
+    bool quiet() const { return quiet_; }
+
+    // Game result for the side to move: 1 win, 0 draw, -1 loss
+    int result() const { return board_.sideToMove() == chess::Color::WHITE ? white_result : -white_result; }
+
+private:
+    bool readChain()
+    {
+        uint8_t header[chain::header_size];
+        if (!in.read(reinterpret_cast<char*>(header), sizeof(header))) return false;
+
+        chess::PackedBoard packed;
+        std::copy(header, header + 24, packed.begin());
+
+        board_ = chess::Board::Compact::decode(packed);
+        ply_ = static_cast<int>(chain::get(header + 24, 2));
+        white_result = static_cast<int8_t>(chain::get(header + 26, 1));
+        remaining = static_cast<int>(chain::get(header + 27, 2));
+        payload.resize(chain::get(header + 29, 4));
+
+        if (!in.read(reinterpret_cast<char*>(payload.data()), static_cast<std::streamsize>(payload.size()))) return false;
+
+        bits = chain::BitReader(payload.data(), payload.size());
+        score_ = 0;
+
+        return true;
+    }
+
+    std::ifstream in;
+    std::vector<uint8_t> payload;
+    chain::BitReader bits = chain::BitReader(nullptr, 0);
+    chess::Movelist moves;
+
+    chess::Board board_;
+    chess::Move move_;
+    int score_ = 0;
+    int ply_ = 0;
+    int white_result = 0;
+    bool quiet_ = false;
+    int remaining = 0;
+};
+
+#endif